@@ -0,0 +1,107 @@
+#ifndef METEOR_DASH_H
+#define METEOR_DASH_H
+
+/*
+ * Userspace <-> kernel interface for /dev/meteor_dash.
+ *
+ * Shared by km/meteor_km.c and the ul/ game loop. A write() or writev() to
+ * the device carries one or more fixed-size struct meteor_cmd back to back,
+ * so the module only has to check the length, version and opcode instead of
+ * parsing text. The whole batch is applied under one lock and drawn once.
+ */
+
+#include <linux/types.h>
+
+#define METEOR_DASH_DEVICE      "/dev/meteor_dash"
+#define METEOR_DASH_VERSION     1
+
+// Maximum number of commands accepted by a single write()
+#define METEOR_MAX_BATCH        16
+
+// Playfield geometry shared by the module and the game loop
+#define METEOR_SCREEN_WIDTH     500
+#define METEOR_SCREEN_HEIGHT    280
+#define METEOR_CHARACTER_SIZE   20
+#define METEOR_SIZE             75
+
+enum meteor_opcode {
+    METEOR_CMD_SET_CHAR_X = 1,      // arg: character x position in pixels
+    METEOR_CMD_SPAWN = 2,           // arg: x position of the new meteor
+    METEOR_CMD_SET_FALL_RATE = 3,   // arg: pixels per tick, also cycles the meteor color
+    METEOR_CMD_SET_INPUT = 4,       // arg: 0 to send SET_CHAR_X, or the speed the module steers with
+    METEOR_CMD_SET_SCORE = 5,       // arg: score shown on screen, reset by every open()
+    METEOR_CMD_SET_LEVEL = 6,       // arg: difficulty level shown on screen, reset by every open()
+};
+
+// Steering speeds for METEOR_CMD_SET_INPUT. When the module steers it samples
+// its own IMU every tick, the character moves METEOR_TILT_SPEED thousandths of
+// a pixel per degree of tilt every METEOR_STEP_MS, times the speed.
+#define METEOR_MAX_INPUT_SPEED  10
+#define METEOR_TILT_SPEED       436
+#define METEOR_STEP_MS          50
+
+struct meteor_cmd {
+    __u8 version;       // METEOR_DASH_VERSION
+    __u8 opcode;        // enum meteor_opcode
+    __u16 reserved;     // must be zero
+    __s32 arg;
+} __attribute__((packed));
+
+/*
+ * read() returns whole struct meteor_event records, oldest first, and blocks
+ * until there is at least one unless the device was opened with O_NONBLOCK.
+ * poll() reports the device readable while events are queued. At most
+ * METEOR_EVENT_QUEUE events are kept, a reader that falls further behind
+ * loses events but never the collision.
+ */
+#define METEOR_EVENT_QUEUE      128
+
+enum meteor_event_type {
+    METEOR_EVENT_TICK = 1,          // arg: number of meteors on screen
+    METEOR_EVENT_SPAWN = 2,         // arg: x position of the new meteor
+    METEOR_EVENT_DESPAWN = 3,       // arg: x position of the meteor that left the screen
+    METEOR_EVENT_COLLISION = 4,     // arg: character x position, the game is over
+};
+
+struct meteor_event {
+    __u8 version;       // METEOR_DASH_VERSION
+    __u8 type;          // enum meteor_event_type
+    __u16 reserved;
+    __u32 tick;         // meteor tick the event happened in
+    __s32 arg;
+} __attribute__((packed));
+
+/*
+ * Shared-memory channel, an alternative to write() for high input rates.
+ *
+ * mmap() at page offset METEOR_MMAP_RING_PGOFF maps a single-producer,
+ * single-consumer ring of commands. Userspace fills slots and then publishes
+ * them by advancing head with release ordering. The module drains the ring on
+ * every render pass and advances tail. Both counters run freely and are masked with
+ * METEOR_RING_SIZE - 1 to find a slot.
+ *
+ * mmap() at page offset METEOR_MMAP_STATE_PGOFF maps a read-only page the
+ * module updates after every render pass. For a consistent snapshot, read seq,
+ * copy the fields and retry if seq was odd or has changed since.
+ */
+#define METEOR_MMAP_RING_PGOFF  0
+#define METEOR_MMAP_STATE_PGOFF 1
+#define METEOR_RING_SIZE        256     // power of two
+
+struct meteor_ring {
+    __u32 head;         // written by userspace only
+    __u32 pad0[15];     // keep head and tail on separate cache lines
+    __u32 tail;         // written by the module only
+    __u32 pad1[15];
+    struct meteor_cmd cmds[METEOR_RING_SIZE];
+};
+
+struct meteor_state {
+    __u32 seq;          // odd while the module updates the page, re-read if it changed
+    __u32 tick;         // number of meteor ticks since the device was opened
+    __u32 n_meteors;
+    __u32 collision;    // non-zero once the character hit a meteor
+    __s32 character_x;
+};
+
+#endif
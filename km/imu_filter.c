@@ -0,0 +1,2 @@
+// The tilt filter is shared with userspace, build the same source into the module
+#include "../ul/imu_filter.c"
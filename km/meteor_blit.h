@@ -0,0 +1,23 @@
+#ifndef METEOR_BLIT_H
+#define METEOR_BLIT_H
+
+#include <linux/types.h>
+#include <linux/fb.h>
+
+// Palette indices a fill can use, the CYG_FB_DEFAULT_PALETTE_* colors
+#define METEOR_BLIT_COLORS 16
+
+// A framebuffer filled with plain stores instead of sys_fillrect, see meteor_blit.c
+struct meteor_blit {
+    u8 *base;
+    u32 line_length;
+    u32 xres;
+    u32 yres;
+    u32 bits_per_pixel;
+    u32 pixels[METEOR_BLIT_COLORS];     // palette index to pixel value
+};
+
+int meteor_blit_init(struct meteor_blit *blit, struct fb_info *fb);
+void meteor_blit_fill(const struct meteor_blit *blit, int x, int y, int w, int h, u32 color);
+
+#endif
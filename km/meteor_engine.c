@@ -0,0 +1,599 @@
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#endif
+
+#include "meteor_engine.h"
+#include "meteor_kernels.h"
+#include "meteor_stats.h"
+
+#define CYG_FB_DEFAULT_PALETTE_BLUE         0x01
+#define CYG_FB_DEFAULT_PALETTE_RED          0x04
+#define CYG_FB_DEFAULT_PALETTE_WHITE        0x0F
+#define CYG_FB_DEFAULT_PALETTE_LIGHTBLUE    0x09
+#define CYG_FB_DEFAULT_PALETTE_BLACK        0x00
+#define CYG_FB_DEFAULT_PALETTE_GREEN        0x02
+#define CYG_FB_DEFAULT_PALETTE_PINK         0x0D
+#define CYG_FB_DEFAULT_PALETTE_YELLOW       0x0E
+#define CYG_FB_DEFAULT_PALETTE_LIGHTGREEN   0x0A
+
+// Active meteors as parallel arrays, packed at the front. The tick and the
+// scans sweep them in order, despawning moves the last meteor into the gap.
+static s16 *meteor_x;
+static s16 *meteor_y;
+static s16 *meteor_w;
+static s16 *meteor_h;
+static s16 *meteor_velocity;        // pixels per tick
+static u8 *meteor_drawn;            // color the meteor is on screen in
+static u8 *meteor_offscreen;        // set by meteor_fall for meteors to despawn
+static void *meteor_store;          // one allocation holds all of the arrays
+static int meteor_capacity;
+int n_meteors = 0;
+meteor_position_t character;
+
+static int meteor_falling_rate = 4;
+int meteor_size = METEOR_SIZE;
+bool game_over = false;
+
+// Shower mode, for capacities above the default. Meteors shrink so that many
+// fit, every spawn drops a cluster of them and they may partly overlap.
+static int meteor_shower;           // meteors per spawn, 0 outside shower mode
+static u32 shower_seed;             // places the cluster, the same every game
+#define SHOWER_SEED 0x9e3779b9
+
+// Clip rectangle for drawing, the visible part of the screen
+static int screen_xres;
+static int screen_yres;
+
+// Handle meteor color changes
+static int meteor_colors[7] = {
+    CYG_FB_DEFAULT_PALETTE_BLUE,
+    CYG_FB_DEFAULT_PALETTE_WHITE,
+    CYG_FB_DEFAULT_PALETTE_RED,
+    CYG_FB_DEFAULT_PALETTE_GREEN,
+    CYG_FB_DEFAULT_PALETTE_PINK,
+    CYG_FB_DEFAULT_PALETTE_YELLOW,
+    CYG_FB_DEFAULT_PALETTE_LIGHTGREEN};
+static int n_meteor_colors = 7;
+static int meteor_color_idx = 0;
+static int meteor_color;
+
+// Fills queued during one render pass, see damage_add
+typedef struct damage_rect {
+    int dx;
+    int dy;
+    int width;
+    int height;
+    u32 color;
+} damage_rect_t;
+
+// Room for the worst case, every meteor queueing a fill on both sides
+#define DAMAGE_PER_METEOR 4
+#define DAMAGE_EXTRA 8
+static damage_rect_t *damage;
+static int max_damage;
+static int n_damage = 0;
+
+// Only the latest fills are looked at for merging, the strips of one entity
+// are queued together so older ones rarely merge and a tick stays linear
+#define DAMAGE_MERGE_WINDOW 8
+static void damage_flush(void);
+
+// Heads-up display along the top of the playfield. Every character has a fixed
+// cell, and a cell is only drawn again when its character changes or a fill
+// went over it.
+#define HUD_Y 4
+#define HUD_HEIGHT 16
+#define HUD_CELL 16
+#define HUD_MAX_CELLS 12
+
+typedef struct hud_field {
+    const char *label;
+    int x;
+    int digits;
+    int max_value;
+    int value;
+    char shown[HUD_MAX_CELLS + 1];  // characters on screen, 0 where a cell needs drawing
+} hud_field_t;
+
+enum { HUD_SCORE, HUD_LEVEL, HUD_METEORS, N_HUD_FIELDS };
+static hud_field_t hud[N_HUD_FIELDS] = {
+    [HUD_SCORE] = { "SCORE ", 8, 6, 999999 },
+    [HUD_LEVEL] = { "LV ", 216, 2, 99 },
+    [HUD_METEORS] = { "METEORS ", 304, 4, 9999 },
+};
+
+
+// Place a meteor at the end of the active list, false if it is full
+static bool meteor_spawn(int x, int y, int width, int height) {
+    int i = n_meteors;
+
+    if (i == meteor_capacity) {
+        return false;
+    }
+    meteor_x[i] = x;
+    meteor_y[i] = y;
+    meteor_w[i] = width;
+    meteor_h[i] = height;
+    meteor_velocity[i] = meteor_falling_rate;
+    meteor_drawn[i] = meteor_color;
+    n_meteors++;
+    return true;
+}
+
+// Remove meteor i, the last active meteor takes its slot
+static void meteor_despawn(int i) {
+    int last = --n_meteors;
+
+    meteor_x[i] = meteor_x[last];
+    meteor_y[i] = meteor_y[last];
+    meteor_w[i] = meteor_w[last];
+    meteor_h[i] = meteor_h[last];
+    meteor_velocity[i] = meteor_velocity[last];
+    meteor_drawn[i] = meteor_drawn[last];
+}
+
+// Queue a fill for the current render pass, merging it into a pending fill of
+// the same color when the union of the two is still a rectangle
+static void damage_add(int x, int y, int w, int h, u32 color) {
+    int i;
+    int xres = screen_xres;
+    int yres = screen_yres;
+    damage_rect_t *d;
+
+    // Clip to the visible screen
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > xres) { w = xres - x; }
+    if (y + h > yres) { h = yres - y; }
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+
+    for (i = max(n_damage - DAMAGE_MERGE_WINDOW, 0); i < n_damage; i++) {
+        d = &damage[i];
+        if (d->color != color) {
+            continue;
+        }
+        // Same columns, touching or overlapping rows
+        if (d->dx == x && d->width == w && y <= d->dy + d->height && d->dy <= y + h) {
+            int bottom = max(d->dy + d->height, y + h);
+            d->dy = min(d->dy, y);
+            d->height = bottom - d->dy;
+            return;
+        }
+        // Same rows, touching or overlapping columns
+        if (d->dy == y && d->height == h && x <= d->dx + d->width && d->dx <= x + w) {
+            int right = max(d->dx + d->width, x + w);
+            d->dx = min(d->dx, x);
+            d->width = right - d->dx;
+            return;
+        }
+    }
+
+    if (n_damage == max_damage) {
+        damage_flush();
+    }
+    d = &damage[n_damage++];
+    d->dx = x;
+    d->dy = y;
+    d->width = w;
+    d->height = h;
+    d->color = color;
+}
+
+// Queue fills for the part of a that is not covered by b
+static void damage_add_difference(const meteor_position_t *a, const meteor_position_t *b, u32 color) {
+    int top = max(a->dy, b->dy);
+    int bottom = min(a->dy + a->height, b->dy + b->height);
+    int left = max(a->dx, b->dx);
+    int right = min(a->dx + a->width, b->dx + b->width);
+
+    if (top >= bottom || left >= right) {
+        // No overlap, all of a is damaged
+        damage_add(a->dx, a->dy, a->width, a->height, color);
+        return;
+    }
+
+    // Full-width strips above and below the overlap, then the sides of it
+    damage_add(a->dx, a->dy, a->width, top - a->dy, color);
+    damage_add(a->dx, bottom, a->width, a->dy + a->height - bottom, color);
+    damage_add(a->dx, top, left - a->dx, bottom - top, color);
+    damage_add(right, top, a->dx + a->width - right, bottom - top, color);
+}
+
+// The HUD is redrawn a cell at a time. Fills that cross it clear the cells
+// they hit, then hud_draw puts back those and any that changed.
+
+// Mark the HUD cells a fill went over for drawing again
+static void hud_invalidate(int x, int y, int w, int h) {
+    hud_field_t *field;
+    int n_cells;
+    int first;
+    int last;
+    int i;
+
+    if (y >= HUD_Y + HUD_HEIGHT || y + h <= HUD_Y) {
+        return;
+    }
+    for (field = hud; field < hud + N_HUD_FIELDS; field++) {
+        n_cells = strlen(field->label) + field->digits;
+        if (x + w <= field->x || x >= field->x + n_cells * HUD_CELL) {
+            continue;
+        }
+        first = max(x - field->x, 0) / HUD_CELL;
+        last = (min(x + w - field->x, n_cells * HUD_CELL) - 1) / HUD_CELL;
+        for (i = first; i <= last; i++) {
+            field->shown[i] = 0;
+        }
+    }
+}
+
+// Draw the HUD cells whose character changed or was painted over
+static void hud_draw(void) {
+    char text[HUD_MAX_CELLS];
+    char cell[2] = "";
+    hud_field_t *field;
+    int n_label;
+    int n_cells;
+    int value;
+    int i;
+
+    hud[HUD_METEORS].value = n_meteors;
+    for (field = hud; field < hud + N_HUD_FIELDS; field++) {
+        n_label = strlen(field->label);
+        n_cells = n_label + field->digits;
+        memcpy(text, field->label, n_label);
+        value = clamp(field->value, 0, field->max_value);
+        for (i = n_cells - 1; i >= n_label; i--, value /= 10) {
+            text[i] = '0' + value % 10;
+        }
+
+        for (i = 0; i < n_cells; i++) {
+            if (text[i] == field->shown[i]) {
+                continue;
+            }
+            // Blanks are black already, whatever went over them erased itself
+            if (text[i] != ' ') {
+                cell[0] = text[i];
+                meteor_text(field->x + i * HUD_CELL + HUD_CELL / 2, HUD_Y, HUD_HEIGHT,
+                            CYG_FB_DEFAULT_PALETTE_WHITE, cell);
+            }
+            field->shown[i] = text[i];
+        }
+    }
+}
+
+// Issue every pending fill. Exposed background goes first so that newly
+// covered pixels win where an entity moved into space another one left.
+static void damage_flush(void) {
+    int i;
+    for (i = 0; i < n_damage; i++) {
+        hud_invalidate(damage[i].dx, damage[i].dy, damage[i].width, damage[i].height);
+        if (damage[i].color == CYG_FB_DEFAULT_PALETTE_BLACK) {
+            meteor_fill(damage[i].dx, damage[i].dy, damage[i].width, damage[i].height,
+                        damage[i].color);
+        }
+    }
+    for (i = 0; i < n_damage; i++) {
+        if (damage[i].color != CYG_FB_DEFAULT_PALETTE_BLACK) {
+            meteor_fill(damage[i].dx, damage[i].dy, damage[i].width, damage[i].height,
+                        damage[i].color);
+        }
+    }
+    n_damage = 0;
+}
+
+// Move an entity on screen, only the strips it exposed and newly covered are drawn
+static void damage_move(const meteor_position_t *old_position, const meteor_position_t *new_position,
+                        u32 color) {
+    damage_add_difference(old_position, new_position, CYG_FB_DEFAULT_PALETTE_BLACK);
+    damage_add_difference(new_position, old_position, color);
+}
+
+static void redraw_character(meteor_position_t *old_position, meteor_position_t *new_position) {
+    damage_move(old_position, new_position, CYG_FB_DEFAULT_PALETTE_LIGHTBLUE);
+}
+
+static void redraw_meteor(meteor_position_t *old_position, meteor_position_t *new_position,
+                          u32 drawn_color) {
+    if (meteor_shower) {
+        // A neighbour's black strip may cut into this meteor, the black fills
+        // go first so painting all of it again covers that
+        damage_add_difference(old_position, new_position, CYG_FB_DEFAULT_PALETTE_BLACK);
+        damage_add(new_position->dx, new_position->dy, new_position->width, new_position->height,
+                   meteor_color);
+        return;
+    }
+    if (meteor_color != drawn_color) {
+        // The color changed, repaint the whole meteor
+        damage_add(old_position->dx, old_position->dy, old_position->width, old_position->height,
+                   CYG_FB_DEFAULT_PALETTE_BLACK);
+        damage_add(new_position->dx, new_position->dy, new_position->width, new_position->height,
+                   meteor_color);
+        return;
+    }
+    damage_move(old_position, new_position, meteor_color);
+}
+
+// Move all meteors down by their velocity
+static void meteor_move_all(void) {
+    meteor_position_t old_position;
+    meteor_position_t new_position;
+    int i;
+
+    // Queue the redraws first, they need the old positions
+    for (i = 0; i < n_meteors; i++) {
+        old_position.dx = meteor_x[i];
+        old_position.dy = meteor_y[i];
+        old_position.width = meteor_w[i];
+        old_position.height = meteor_h[i];
+        new_position = old_position;
+        new_position.dy += meteor_velocity[i];
+        redraw_meteor(&old_position, &new_position, meteor_drawn[i]);
+        meteor_drawn[i] = meteor_color;
+    }
+
+    if (!meteor_fall(meteor_y, meteor_velocity, meteor_offscreen, n_meteors,
+                     METEOR_SCREEN_HEIGHT)) {
+        return;
+    }
+
+    // Delete meteors that went past the screen. Backwards, so every meteor
+    // despawning moves into a gap has already been checked.
+    for (i = n_meteors - 1; i >= 0; i--) {
+        if (meteor_offscreen[i]) {
+            meteor_emit(METEOR_EVENT_DESPAWN, meteor_x[i]);
+            meteor_despawn(i);
+            meteor_stat_inc(METEOR_STAT_DESPAWNS);
+        }
+    }
+}
+
+// Check if a meteor near the top is colliding with a new one at x
+static bool meteor_spawn_blocked(int x) {
+    return meteor_overlap_any(meteor_x, meteor_y, meteor_w, meteor_h, n_meteors,
+                              x, 0, x + meteor_size, meteor_size);
+}
+
+// xorshift32, the cluster layout has to replay the same in the sim
+static u32 shower_rand(void) {
+    shower_seed ^= shower_seed << 13;
+    shower_seed ^= shower_seed >> 17;
+    shower_seed ^= shower_seed << 5;
+    return shower_seed;
+}
+
+// Drop a cluster of meteors over the METEOR_SIZE wide band at x, staggered
+// above the screen so they come in over a few ticks. Partial overlaps are
+// allowed, a meteor is only turned away when its center is already covered.
+static void meteor_shower_spawn(int x) {
+    int spread = METEOR_SIZE - meteor_size + 1;
+    int mx, my, cx, cy;
+    int i;
+
+    for (i = 0; i < meteor_shower; i++) {
+        mx = min(x + (int)(shower_rand() % spread), METEOR_SCREEN_WIDTH - meteor_size);
+        my = -(int)(shower_rand() % METEOR_SIZE);
+        cx = mx + meteor_size / 2;
+        cy = my + meteor_size / 2;
+        if (n_meteors == meteor_capacity ||
+            meteor_overlap_any(meteor_x, meteor_y, meteor_w, meteor_h, n_meteors,
+                               cx, cy, cx + 1, cy + 1)) {
+            meteor_stat_inc(METEOR_STAT_SPAWN_REJECTS);
+            continue;
+        }
+        meteor_spawn(mx, my, meteor_size, meteor_size);
+        meteor_emit(METEOR_EVENT_SPAWN, mx);
+        meteor_stat_inc(METEOR_STAT_SPAWNS);
+    }
+}
+
+// Apply a single checked command to the game state. Nothing is drawn here,
+// meteor_end_batch draws the result once per batch. SET_INPUT is up to the platform.
+void meteor_apply_cmd(const struct meteor_cmd *cmd, struct meteor_batch *batch) {
+    int i;
+
+    switch (cmd->opcode) {
+    case METEOR_CMD_SET_FALL_RATE:
+        // Increase meteor falling rate, meteors already falling speed up too
+        meteor_falling_rate = cmd->arg;
+        for (i = 0; i < n_meteors; i++) {
+            meteor_velocity[i] = meteor_falling_rate;
+        }
+
+        // Update meteor color
+        meteor_color_idx++;
+        if (meteor_color_idx >= n_meteor_colors) {
+            meteor_color_idx = 0;
+        }
+        meteor_color = meteor_colors[meteor_color_idx];
+        break;
+
+    case METEOR_CMD_SET_CHAR_X:
+        batch->character_x = cmd->arg;
+        break;
+
+    case METEOR_CMD_SPAWN:
+        if (meteor_shower) {
+            meteor_shower_spawn(cmd->arg);
+            break;
+        }
+
+        if (n_meteors == meteor_capacity) {
+            // No room left, skip this creation
+            meteor_stat_inc(METEOR_STAT_SPAWN_REJECTS);
+            break;
+        }
+
+        if (meteor_spawn_blocked(cmd->arg)) {
+            meteor_stat_inc(METEOR_STAT_SPAWN_REJECTS);
+            break;
+        }
+
+        meteor_spawn(cmd->arg, 0, meteor_size, meteor_size);
+        meteor_emit(METEOR_EVENT_SPAWN, cmd->arg);
+        meteor_stat_inc(METEOR_STAT_SPAWNS);
+        break;
+
+    case METEOR_CMD_SET_SCORE:
+        hud[HUD_SCORE].value = cmd->arg;
+        break;
+
+    case METEOR_CMD_SET_LEVEL:
+        hud[HUD_LEVEL].value = cmd->arg;
+        break;
+    }
+}
+
+// Check the character against every meteor near the bottom of the screen
+static bool meteor_check_collision(int character_x) {
+    // Meteors count from the character's top row down to below the screen
+    int collision_y = METEOR_SCREEN_HEIGHT - 31;
+
+    return meteor_overlap_any(meteor_x, meteor_y, meteor_w, meteor_h, n_meteors,
+                              character_x, collision_y,
+                              character_x + METEOR_CHARACTER_SIZE, S16_MAX);
+}
+
+// Replace the playfield with the game over screen
+static void meteor_game_over(void) {
+    meteor_stat_inc(METEOR_STAT_COLLISIONS);
+    game_over = true;
+    meteor_emit(METEOR_EVENT_COLLISION, character.dx);
+
+    // Redraw screen to black, pending fills are covered by it
+    n_damage = 0;
+    meteor_fill(0, 0, METEOR_SCREEN_WIDTH, METEOR_SCREEN_HEIGHT, CYG_FB_DEFAULT_PALETTE_BLACK);
+
+    meteor_text(METEOR_SCREEN_WIDTH / 2, 25, 64, CYG_FB_DEFAULT_PALETTE_WHITE, "GAME");
+    meteor_text(METEOR_SCREEN_WIDTH / 2, 120, 64, CYG_FB_DEFAULT_PALETTE_WHITE, "OVER");
+
+    // Leave the final score up
+    hud_invalidate(0, 0, METEOR_SCREEN_WIDTH, METEOR_SCREEN_HEIGHT);
+    hud_draw();
+}
+
+// Queue the drawing for a batch of commands.
+// Returns true if the character ran into a meteor.
+static bool meteor_render_batch(const struct meteor_batch *batch) {
+    meteor_position_t new_character_position;
+    int i;
+
+    if (batch->character_x >= 0) {
+        // Redraw the character
+        new_character_position.dx = batch->character_x;
+        new_character_position.dy = 250;
+        new_character_position.width = METEOR_CHARACTER_SIZE;
+        new_character_position.height = METEOR_CHARACTER_SIZE;
+        redraw_character(&character, &new_character_position);
+        character.dx = batch->character_x;
+
+        // Check if there is a collision
+        if (meteor_check_collision(batch->character_x)) {
+            return true;
+        }
+    }
+
+    // Draw the meteors spawned by this batch
+    for (i = batch->first_spawn; i < n_meteors; i++) {
+        damage_add(meteor_x[i], meteor_y[i], meteor_w[i], meteor_h[i], meteor_color);
+    }
+    return false;
+}
+
+// Start a render pass. Ticks move the meteors before the new input is applied,
+// so spawned meteors start falling on the next tick.
+void meteor_begin_batch(struct meteor_batch *batch, bool tick) {
+    if (tick) {
+        meteor_move_all();
+    }
+    batch->character_x = -1;
+    batch->first_spawn = n_meteors;
+}
+
+// Draw what the batch changed, returns true if it ended the game
+bool meteor_end_batch(const struct meteor_batch *batch, bool tick) {
+    // Meteors can also fall onto a character that stands still
+    if (meteor_render_batch(batch) || (tick && meteor_check_collision(character.dx))) {
+        meteor_game_over();
+        return true;
+    }
+    damage_flush();
+    hud_draw();
+    return false;
+}
+
+// Allocate room for capacity meteors, spawn and despawn never allocate
+int meteor_engine_init(int xres, int yres, int capacity) {
+    size_t n = capacity;
+
+    if (capacity < 1 || capacity > METEOR_MAX_CAPACITY) {
+        return -EINVAL;
+    }
+    meteor_store = kcalloc(n, 5 * sizeof(s16) + 2 * sizeof(u8), GFP_KERNEL);
+    max_damage = DAMAGE_PER_METEOR * capacity + DAMAGE_EXTRA;
+    damage = kcalloc(max_damage, sizeof(*damage), GFP_KERNEL);
+    if (!meteor_store || !damage) {
+        meteor_engine_exit();
+        return -ENOMEM;
+    }
+    meteor_x = meteor_store;
+    meteor_y = meteor_x + n;
+    meteor_w = meteor_y + n;
+    meteor_h = meteor_w + n;
+    meteor_velocity = meteor_h + n;
+    meteor_drawn = (u8 *)(meteor_velocity + n);
+    meteor_offscreen = meteor_drawn + n;
+    meteor_capacity = capacity;
+
+    // Above the default, shrink the meteors so capacity of them cover about
+    // as much of the screen as the default number of full size ones
+    meteor_size = METEOR_SIZE;
+    meteor_shower = 0;
+    if (capacity > METEOR_DEFAULT_CAPACITY) {
+        meteor_size = max(METEOR_SHOWER_MIN_SIZE,
+                          (int) int_sqrt(METEOR_SIZE * METEOR_SIZE * METEOR_DEFAULT_CAPACITY / capacity));
+        meteor_shower = capacity / METEOR_DEFAULT_CAPACITY;
+    }
+
+    screen_xres = xres;
+    screen_yres = yres;
+    meteor_engine_reset();
+    return 0;
+}
+
+void meteor_engine_exit(void) {
+    kfree(meteor_store);
+    kfree(damage);
+    meteor_store = NULL;
+    damage = NULL;
+    meteor_capacity = 0;
+    n_meteors = 0;
+}
+
+// Empty the playfield, the meteor colors start over
+void meteor_engine_reset(void) {
+    n_meteors = 0;
+    n_damage = 0;
+    meteor_color_idx = 0;
+    shower_seed = SHOWER_SEED;
+}
+
+// Clear whatever the last game left on screen and put the character back at its start
+void meteor_new_game(void) {
+    character.dx = 250;
+    character.dy = 250;
+    character.width = METEOR_CHARACTER_SIZE;
+    character.height = METEOR_CHARACTER_SIZE;
+    game_over = false;
+    hud[HUD_SCORE].value = 0;
+    hud[HUD_LEVEL].value = 0;
+
+    meteor_fill(0, 0, METEOR_SCREEN_WIDTH, METEOR_SCREEN_HEIGHT, CYG_FB_DEFAULT_PALETTE_BLACK);
+    meteor_fill(character.dx, character.dy, character.width, character.height,
+                CYG_FB_DEFAULT_PALETTE_LIGHTBLUE);
+    hud_invalidate(0, 0, METEOR_SCREEN_WIDTH, METEOR_SCREEN_HEIGHT);
+    hud_draw();
+}
@@ -0,0 +1,61 @@
+#ifndef METEOR_ENGINE_H
+#define METEOR_ENGINE_H
+
+/*
+ * Game rules and drawing, without anything that ties them to the kernel.
+ *
+ * The module links this with its framebuffer and the sim/ host build links it
+ * with an in-memory one. Whoever links it provides meteor_fill(), meteor_text()
+ * and meteor_emit() and serializes every call, nothing here sleeps or locks.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include "kcompat.h"
+#endif
+
+#include "meteor_dash.h"
+
+// Period of the meteor tick
+#define METEOR_TICK_MS 100
+
+// Meteors on screen at once. Above the default the engine switches to shower
+// mode, with smaller meteors that spawn in clusters and may overlap.
+#define METEOR_DEFAULT_CAPACITY 32
+#define METEOR_MAX_CAPACITY 4096
+#define METEOR_SHOWER_MIN_SIZE 8
+
+typedef struct meteor_position {
+    int dx;
+    int dy;
+    int width;
+    int height;
+} meteor_position_t;
+
+// State collected while applying one batch of commands
+struct meteor_batch {
+    int character_x;    // latest requested character position, -1 if unchanged
+    int first_spawn;    // index of the first meteor added by this batch
+};
+
+extern meteor_position_t character;
+extern int n_meteors;
+extern int meteor_size;
+extern bool game_over;
+
+// Provided by the platform
+void meteor_fill(int x, int y, int w, int h, u32 color);
+void meteor_text(int center_x, int y, int height, u32 color, const char *text);
+void meteor_emit(u8 type, s32 arg);
+
+// Function declarations
+int meteor_engine_init(int xres, int yres, int capacity);
+void meteor_engine_exit(void);
+void meteor_engine_reset(void);
+void meteor_new_game(void);
+void meteor_begin_batch(struct meteor_batch *batch, bool tick);
+void meteor_apply_cmd(const struct meteor_cmd *cmd, struct meteor_batch *batch);
+bool meteor_end_batch(const struct meteor_batch *batch, bool tick);
+
+#endif
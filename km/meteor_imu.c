@@ -0,0 +1,182 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/i2c.h>
+#include <linux/delay.h>
+
+#include "meteor_imu.h"
+
+// The SparkFun 9-DOF board on the BeagleBone's I2C2 pins
+#define IMU_I2C_BUS         2
+#define IMU_I2C_ADDRESS     0x68
+
+// ICM-20948 bank 0 registers
+#define REG_BANK_SEL        0x7F
+#define WHO_AM_I_REG        0x00
+#define WHO_AM_I_EXPECTED   0xEA
+#define PWR_MGMT_1          0x06
+#define PWR_MGMT_2          0x07
+#define ACCEL_XOUT_H        0x2D
+
+// Accel, gyro and temperature output registers are contiguous
+#define IMU_BURST_LEN       14
+
+// Gyro output rate after reset is 1.1 kHz, calibration reads every sample
+#define IMU_CALIBRATION_MIN_US  1000
+#define IMU_CALIBRATION_MAX_US  2000
+
+static struct i2c_client *imu_client;
+static s32 imu_gyro_bias;
+static bool imu_registered;
+
+// One combined register write and 14-byte read, sleeps. Returns 0 or an
+// error code.
+static int imu_read_burst(struct i2c_client *client, imu_raw_t *raw) {
+    u8 buf[IMU_BURST_LEN];
+    int ret;
+
+    ret = i2c_smbus_read_i2c_block_data(client, ACCEL_XOUT_H, IMU_BURST_LEN, buf);
+    if (ret != IMU_BURST_LEN) {
+        return ret < 0 ? ret : -EIO;
+    }
+
+    // Registers are big-endian
+    raw->accel_x = (s16)(buf[0] << 8 | buf[1]);
+    raw->accel_y = (s16)(buf[2] << 8 | buf[3]);
+    raw->accel_z = (s16)(buf[4] << 8 | buf[5]);
+    raw->gyro_x = (s16)(buf[6] << 8 | buf[7]);
+    raw->gyro_y = (s16)(buf[8] << 8 | buf[9]);
+    raw->gyro_z = (s16)(buf[10] << 8 | buf[11]);
+    return 0;
+}
+
+// Measure the gyro bias once, the board must be still while the module loads.
+// Every game after that starts from it without waiting.
+static int imu_calibrate(struct i2c_client *client) {
+    imu_filter_t filter;
+    imu_raw_t raw;
+    int ret;
+
+    imu_filter_init(&filter);
+    while (!imu_filter_calibrated(&filter)) {
+        usleep_range(IMU_CALIBRATION_MIN_US, IMU_CALIBRATION_MAX_US);
+        ret = imu_read_burst(client, &raw);
+        if (ret != 0) {
+            return ret;
+        }
+        imu_filter_update(&filter, &raw, 0);
+    }
+    imu_gyro_bias = filter.gyro_bias;
+    return 0;
+}
+
+static int meteor_imu_probe(struct i2c_client *client, const struct i2c_device_id *id) {
+    int who_am_i;
+    int ret;
+
+    // Bank 0, then soft reset to get the chip into a clean state
+    i2c_smbus_write_byte_data(client, REG_BANK_SEL, 0x00);
+    i2c_smbus_write_byte_data(client, PWR_MGMT_1, 0x80);
+    msleep(100);
+
+    who_am_i = i2c_smbus_read_byte_data(client, WHO_AM_I_REG);
+    if (who_am_i != WHO_AM_I_EXPECTED) {
+        pr_err("meteor_imu: unexpected WHO_AM_I 0x%02x\n", who_am_i);
+        return -ENODEV;
+    }
+
+    // Wake up with the PLL clock, enable accelerometer and gyroscope
+    if (i2c_smbus_write_byte_data(client, PWR_MGMT_1, 0x01) < 0 ||
+        i2c_smbus_write_byte_data(client, PWR_MGMT_2, 0x00) < 0) {
+        pr_err("meteor_imu: failed to enable sensors\n");
+        return -EIO;
+    }
+    msleep(10);
+
+    ret = imu_calibrate(client);
+    if (ret != 0) {
+        pr_err("meteor_imu: failed to calibrate gyro: %d\n", ret);
+        return ret;
+    }
+
+    imu_client = client;
+    return 0;
+}
+
+static int meteor_imu_remove(struct i2c_client *client) {
+    imu_client = NULL;
+    return 0;
+}
+
+static const struct i2c_device_id meteor_imu_id[] = {
+    { "icm20948", 0 },
+    { }
+};
+MODULE_DEVICE_TABLE(i2c, meteor_imu_id);
+
+static struct i2c_driver meteor_imu_driver = {
+    .driver = {
+        .name = "meteor_imu",
+    },
+    .probe = meteor_imu_probe,
+    .remove = meteor_imu_remove,
+    .id_table = meteor_imu_id,
+};
+
+static struct i2c_board_info meteor_imu_info = {
+    I2C_BOARD_INFO("icm20948", IMU_I2C_ADDRESS),
+};
+
+static struct i2c_client *imu_device;
+
+// Register the driver and instantiate the sensor on its bus, which takes the
+// address away from i2c-dev. Returns 0 when the driver is registered,
+// meteor_imu_present tells if a sensor answered.
+int meteor_imu_init(void) {
+    struct i2c_adapter *adapter;
+    int ret;
+
+    ret = i2c_add_driver(&meteor_imu_driver);
+    if (ret < 0) {
+        return ret;
+    }
+    imu_registered = true;
+
+    adapter = i2c_get_adapter(IMU_I2C_BUS);
+    if (!adapter) {
+        pr_err("meteor_imu: no i2c-%d adapter\n", IMU_I2C_BUS);
+        return 0;
+    }
+    imu_device = i2c_new_device(adapter, &meteor_imu_info);
+    i2c_put_adapter(adapter);
+    return 0;
+}
+
+void meteor_imu_exit(void) {
+    if (!imu_registered) {
+        return;
+    }
+    if (imu_device) {
+        i2c_unregister_device(imu_device);
+        imu_device = NULL;
+    }
+    i2c_del_driver(&meteor_imu_driver);
+    imu_registered = false;
+}
+
+bool meteor_imu_present(void) {
+    return imu_client != NULL;
+}
+
+// Gyro_y offset in raw counts, measured when the sensor was probed
+s32 meteor_imu_gyro_bias(void) {
+    return imu_gyro_bias;
+}
+
+// One combined register write and 14-byte read, sleeps. Returns 0 or an
+// error code.
+int meteor_imu_read(imu_raw_t *raw) {
+    if (!imu_client) {
+        return -ENODEV;
+    }
+    return imu_read_burst(imu_client, raw);
+}
@@ -0,0 +1,15 @@
+#ifndef METEOR_IMU_H
+#define METEOR_IMU_H
+
+#include <linux/types.h>
+
+#include "imu_filter.h"
+
+// In-kernel ICM-20948 driver, see meteor_imu.c
+int meteor_imu_init(void);
+void meteor_imu_exit(void);
+bool meteor_imu_present(void);
+s32 meteor_imu_gyro_bias(void);
+int meteor_imu_read(imu_raw_t *raw);
+
+#endif
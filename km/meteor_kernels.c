@@ -0,0 +1,44 @@
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#ifdef CONFIG_KERNEL_MODE_NEON
+#include <asm/neon.h>
+#include <asm/simd.h>
+#endif
+#endif
+
+#include "meteor_kernels.h"
+
+// NEON registers are only usable where the kernel can save them. Where it
+// cannot, the sweeps run as plain C.
+#if defined(__KERNEL__) && defined(CONFIG_KERNEL_MODE_NEON)
+#define METEOR_NEON
+#endif
+
+bool meteor_fall(s16 *y, const s16 *velocity, u8 *offscreen, int n, int limit) {
+#ifdef METEOR_NEON
+    bool any;
+
+    if (may_use_simd()) {
+        kernel_neon_begin();
+        any = meteor_fall_neon(y, velocity, offscreen, n, limit);
+        kernel_neon_end();
+        return any;
+    }
+#endif
+    return __meteor_fall(y, velocity, offscreen, n, limit);
+}
+
+bool meteor_overlap_any(const s16 *x, const s16 *y, const s16 *w, const s16 *h, int n,
+                        int x0, int y0, int x1, int y1) {
+#ifdef METEOR_NEON
+    bool hit;
+
+    if (may_use_simd()) {
+        kernel_neon_begin();
+        hit = meteor_overlap_any_neon(x, y, w, h, n, x0, y0, x1, y1);
+        kernel_neon_end();
+        return hit;
+    }
+#endif
+    return __meteor_overlap_any(x, y, w, h, n, x0, y0, x1, y1);
+}
@@ -0,0 +1,66 @@
+#ifndef METEOR_KERNELS_H
+#define METEOR_KERNELS_H
+
+/*
+ * Sweeps over the meteor arrays, one pass each and without branches so the
+ * compiler can turn them into SIMD loops.
+ *
+ * The loops are the static inline bodies at the end of this file.
+ * meteor_kernels.c builds them for the host and as the kernel's scalar
+ * fallback. On ARM, meteor_kernels_neon.c builds them again with NEON enabled.
+ * The module's render passes run in process context so the NEON build is the
+ * one that normally runs there.
+ */
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/types.h>
+#else
+#include "kcompat.h"
+#endif
+
+// Function declarations
+bool meteor_fall(s16 *y, const s16 *velocity, u8 *offscreen, int n, int limit);
+bool meteor_overlap_any(const s16 *x, const s16 *y, const s16 *w, const s16 *h, int n,
+                        int x0, int y0, int x1, int y1);
+
+#if defined(__KERNEL__) && defined(CONFIG_KERNEL_MODE_NEON)
+// Only between kernel_neon_begin() and kernel_neon_end()
+bool meteor_fall_neon(s16 *y, const s16 *velocity, u8 *offscreen, int n, int limit);
+bool meteor_overlap_any_neon(const s16 *x, const s16 *y, const s16 *w, const s16 *h, int n,
+                             int x0, int y0, int x1, int y1);
+#endif
+
+// Move every meteor down by its velocity and set offscreen[i] for the ones
+// now below limit, true if there are any
+static inline bool __meteor_fall(s16 *y, const s16 *velocity, u8 *offscreen, int n, int limit) {
+    s16 bottom = limit;
+    u8 any = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        y[i] += velocity[i];
+        offscreen[i] = y[i] > bottom;
+        any |= offscreen[i];
+    }
+    return any;
+}
+
+// Check if any meteor overlaps the box from (x0, y0) up to (x1, y1), exclusive
+static inline bool __meteor_overlap_any(const s16 *x, const s16 *y, const s16 *w, const s16 *h,
+                                        int n, int x0, int y0, int x1, int y1) {
+    s16 left = x0;
+    s16 top = y0;
+    s16 right = x1;
+    s16 bottom = y1;
+    u8 hit = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        hit |= (x[i] < right) & ((s16)(x[i] + w[i]) > left) &
+               (y[i] < bottom) & ((s16)(y[i] + h[i]) > top);
+    }
+    return hit;
+}
+
+#endif
@@ -0,0 +1,18 @@
+/*
+ * NEON builds of the meteor sweeps. The Makefile compiles this file alone
+ * with -mfpu=neon and the vectorizer on, so nothing here may run outside
+ * kernel_neon_begin() and kernel_neon_end(). See meteor_kernels.c.
+ */
+
+#include <linux/kernel.h>
+
+#include "meteor_kernels.h"
+
+bool meteor_fall_neon(s16 *y, const s16 *velocity, u8 *offscreen, int n, int limit) {
+    return __meteor_fall(y, velocity, offscreen, n, limit);
+}
+
+bool meteor_overlap_any_neon(const s16 *x, const s16 *y, const s16 *w, const s16 *h, int n,
+                             int x0, int y0, int x1, int y1) {
+    return __meteor_overlap_any(x, y, w, h, n, x0, y0, x1, y1);
+}
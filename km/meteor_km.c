@@ -9,152 +9,135 @@
 #include <linux/jiffies.h> // for jiffies global variable
 #include <linux/string.h> // for string manipulation functions
 #include <linux/ctype.h> // for isdigit
-#include <linux/font.h> // for default font
+#include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/seqlock.h>
+#include <linux/kfifo.h>
+#include <linux/uio.h> // for iov_iter
+#include <linux/mm.h> // for mmap
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/moduleparam.h>
+#include <linux/vmalloc.h> // for the shadow framebuffer
+#include <linux/console.h> // for console_lock around fb_pan_display
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+#include "meteor_dash.h"
+#include "meteor_engine.h"
+#include "meteor_blit.h"
+#include "meteor_text.h"
+#include "meteor_imu.h"
+#include "meteor_stats.h"
 
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Meteor game");
 
-#define CYG_FB_DEFAULT_PALETTE_BLUE         0x01
-#define CYG_FB_DEFAULT_PALETTE_RED          0x04
-#define CYG_FB_DEFAULT_PALETTE_WHITE        0x0F
-#define CYG_FB_DEFAULT_PALETTE_LIGHTBLUE    0x09
-#define CYG_FB_DEFAULT_PALETTE_BLACK        0x00
-#define CYG_FB_DEFAULT_PALETTE_GREEN        0x02
-#define CYG_FB_DEFAULT_PALETTE_PINK         0x0D
-#define CYG_FB_DEFAULT_PALETTE_YELLOW       0x0E
-#define CYG_FB_DEFAULT_PALETTE_LIGHTGREEN   0x0A
-
 // Device file definitions
 static int meteor_open(struct inode *inode, struct file *filp);
 static int meteor_release(struct inode *inode, struct file *filp);
-static ssize_t meteor_write(struct file *filp, const char *buf, size_t count, loff_t *f_pos);
-static ssize_t meteor_read(struct file *filp, char *buf, size_t count, loff_t *f_pos);
+static ssize_t meteor_write_iter(struct kiocb *iocb, struct iov_iter *from);
+static ssize_t meteor_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos);
+static __poll_t meteor_poll(struct file *filp, poll_table *wait);
+static int meteor_mmap(struct file *filp, struct vm_area_struct *vma);
 static void meteor_handler(struct timer_list*);
+static void meteor_tick_work(struct work_struct *work);
+static void meteor_input_work(struct work_struct *work);
+static void meteor_frame(bool tick);
+static void meteor_imu_work(struct work_struct *work);
 
 struct file_operations meteor_fops = {
-write:
-    meteor_write,
+write_iter:
+    meteor_write_iter,
 read:
     meteor_read,
+poll:
+    meteor_poll,
 open:
     meteor_open,
 release:
     meteor_release,
+mmap:
+    meteor_mmap,
 };
 
 // Global variables for meteors and character
 struct fb_info *info;
-struct fb_fillrect *blank;
 
-typedef struct meteor_position {
-    int dx;
-    int dy;
-    int width;
-    int height;
-} meteor_position_t;
+// Output mode, everything is drawn to target which is either the screen or a shadow copy of it
+static bool double_buffer = false;
+module_param(double_buffer, bool, 0444);
+MODULE_PARM_DESC(double_buffer, "Compose frames off-screen and present them at vblank (default: draw to the screen)");
+
+// Meteors the playfield can hold, raise it for meteor showers
+static int max_meteors = METEOR_DEFAULT_CAPACITY;
+module_param(max_meteors, int, 0444);
+MODULE_PARM_DESC(max_meteors, "Meteors on screen at once, 1 to 4096 (default: 32)");
+
+// The module only takes the IMU when asked, userspace reads it through i2c-dev otherwise
+static bool kernel_imu = false;
+module_param(kernel_imu, bool, 0444);
+MODULE_PARM_DESC(kernel_imu, "Drive the IMU from the module for SET_INPUT, which takes it away from userspace (default: off)");
+
+static struct fb_info *target;
+static struct fb_info shadow_info;
+static struct meteor_blit blit;     // fills into target's memory
+static bool direct_fill = false;    // blit is usable, otherwise sys_fillrect
+static bool page_flip = false;      // the framebuffer has a second page to pan to
+static int front_page = 0;
+static u32 saved_yoffset;
+static struct {
+    int y0;
+    int y1;
+} page_dirty[2];                    // rows of each page that are older than the shadow buffer
+static struct work_struct present_work;
+static bool flip_pending = false;   // a flip is queued, the back page may still be on screen
+static bool unpresented = false;    // the shadow buffer has changes no page has seen yet
 
 // Meteor updates
 static struct timer_list * timer;
-static int meteor_update_rate_ms = 100;
-static meteor_position_t *meteors[32];
-static meteor_position_t * new_meteor_position;
-static int n_meteors = 0;
-static int meteor_falling_rate = 4;
-static int meteor_size = 75;
-static struct mutex meteor_mutex;
-
-// Handle meteor color changes
-static int meteor_colors[7] = {
-    CYG_FB_DEFAULT_PALETTE_BLUE,
-    CYG_FB_DEFAULT_PALETTE_WHITE,
-    CYG_FB_DEFAULT_PALETTE_RED,
-    CYG_FB_DEFAULT_PALETTE_GREEN,
-    CYG_FB_DEFAULT_PALETTE_PINK,
-    CYG_FB_DEFAULT_PALETTE_YELLOW,
-    CYG_FB_DEFAULT_PALETTE_LIGHTGREEN};
-static int n_meteor_colors = 7;
-static int meteor_color_idx = 0;
-static int meteor_color;
-
-// Temporary varibles for updating meteor and character positions
-static meteor_position_t * character;
-static meteor_position_t * new_character_position;
-
-// Game over global variables
-static const uint8_t font_5x7[][7] = {
-    // G
-    {
-        0b01110,
-        0b10001,
-        0b10000,
-        0b10111,
-        0b10001,
-        0b10001,
-        0b01110
-    },
-    // A
-    {
-        0b01110,
-        0b10001,
-        0b10001,
-        0b11111,
-        0b10001,
-        0b10001,
-        0b10001
-    },
-    // M
-    {
-        0b10001,
-        0b11011,
-        0b10101,
-        0b10101,
-        0b10001,
-        0b10001,
-        0b10001
-    },
-    // E
-    {
-        0b11111,
-        0b10000,
-        0b10000,
-        0b11110,
-        0b10000,
-        0b10000,
-        0b11111
-    },
-    // O
-    {
-        0b01110,
-        0b10001,
-        0b10001,
-        0b10001,
-        0b10001,
-        0b10001,
-        0b01110
-    },
-    // V
-    {
-        0b10001,
-        0b10001,
-        0b10001,
-        0b10001,
-        0b10001,
-        0b01010,
-        0b00100
-    },
-    // R
-    {
-        0b11110,
-        0b10001,
-        0b10001,
-        0b11110,
-        0b10100,
-        0b10010,
-        0b10001
-    },
-};
-static enum { G, A, M, E, O, V, R };
+static int meteor_update_rate_ms = METEOR_TICK_MS;
+static ktime_t tick_due;            // when the armed timer should fire
+static bool ticking = false;        // the tick may re-arm the timer, cleared by release
+static struct work_struct tick_work;
+
+/*
+ * Locking: the game state, the damage list and the shadow buffer belong to the
+ * render passes, which run in process context on system_highpri_wq (tick_work,
+ * queued by the meteor timer, and input_work) and serialize on the state_lock
+ * mutex. Outside of interrupts the meteor sweeps can use NEON.
+ *
+ * write() never touches that state or waits for a render. It queues commands
+ * in input_fifo, serialized against other writers by input_lock only, and
+ * queues input_work. Results flow back through a seqlock-protected snapshot
+ * that the render passes publish.
+ */
+static DEFINE_MUTEX(state_lock);
+static DEFINE_SPINLOCK(input_lock);
+static DEFINE_KFIFO(input_fifo, struct meteor_cmd, 4 * METEOR_MAX_BATCH);
+static struct work_struct input_work;
+static DEFINE_SEQLOCK(state_seqlock);
+static struct meteor_state published_state;
+static u32 meteor_tick;             // ticks this game, counted before the tick moves anything
+
+// Events for read(), produced by the render passes and consumed by readers,
+// which serialize on event_lock among themselves
+static DEFINE_KFIFO(event_fifo, struct meteor_event, METEOR_EVENT_QUEUE);
+static DEFINE_SPINLOCK(event_lock);
+static DECLARE_WAIT_QUEUE_HEAD(event_wait);
+
+// Shared-memory command ring and read-only game state, see meteor_dash.h
+static struct meteor_ring *cmd_ring;
+static struct meteor_state *game_state;
+
+// In-kernel steering, every tick samples the IMU and moves the character
+static int imu_speed = 0;           // 0 while userspace sends SET_CHAR_X
+static bool imu_restart = false;    // restart the estimate with the next sample
+static struct work_struct imu_work;
+static imu_filter_t imu_filter;
+static s32 imu_character_mpx;       // character x in thousandths of a pixel
+static ktime_t imu_last_sample;
 
 // Helper functions
 /* Helper function borrowed from drivers/video/fbdev/core/fbmem.c */
@@ -172,211 +155,410 @@ static struct fb_info *get_fb_info(unsigned int idx)
     return fb_info;
 }
 
-static int redraw_character(meteor_position_t *old_position, meteor_position_t *new_position) {
-    // Draw rectangle at the old position in black
-    blank->dx = old_position->dx;
-    blank->dy = old_position->dy;
-    blank->width = old_position->width;
-    blank->height = old_position->height;
-    blank->color = CYG_FB_DEFAULT_PALETTE_BLACK;
-    blank->rop = ROP_COPY;
-    sys_fillrect(info, blank);
-
-    // Draw rectangle at new position in red
-    blank->dx = new_position->dx;
-    blank->dy = new_position->dy;
-    blank->width = new_position->width;
-    blank->height = new_position->height;
-    blank->color = CYG_FB_DEFAULT_PALETTE_LIGHTBLUE;
-    blank->rop = ROP_COPY;
-    sys_fillrect(info, blank);
-}
-
-static int redraw_meteor(meteor_position_t *old_position, meteor_position_t *new_position) {
-    // Draw rectangle at the old position in black
-    blank->dx = old_position->dx;
-    blank->dy = old_position->dy;
-    blank->width = old_position->width;
-    blank->height = old_position->height;
-    blank->color = CYG_FB_DEFAULT_PALETTE_BLACK;
-    blank->rop = ROP_COPY;
-    sys_fillrect(info, blank);
-
-    // Draw rectangle at new position in red
-    blank->dx = new_position->dx;
-    blank->dy = new_position->dy;
-    blank->width = new_position->width;
-    blank->height = new_position->height;
-    blank->color = meteor_color;
-    blank->rop = ROP_COPY;
-    sys_fillrect(info, blank);
-}
-
-static void draw_rect(struct fb_info *info, int x, int y, int w, int h, u32 color) {
-    struct fb_fillrect rect = {
-        .dx = x,
-        .dy = y,
-        .width = w,
-        .height = h,
-        .color = color,
-        .rop = ROP_COPY,
-    };
-    sys_fillrect(info, &rect);
-}
-
-static void draw_char(struct fb_info *info, int letter_index,
-                      int x, int y, int pixel_size, u32 color)
-{
-    int row;
-    int col;
-    for (row = 0; row < 7; row++) {
-        uint8_t line = font_5x7[letter_index][row];
-
-        for (col = 0; col < 5; col++) {
-            if (line & (1 << (4 - col))) {
-                draw_rect(info,
-                          x + col * pixel_size,
-                          y + row * pixel_size,
-                          pixel_size,
-                          pixel_size,
-                          color);
-            }
+// Remember which rows both framebuffer pages need from the shadow buffer
+static void present_mark_dirty(int y, int h) {
+    int i;
+    int y1 = min(y + h, (int) shadow_info.var.yres);
+
+    y = max(y, 0);
+    if (y >= y1) {
+        return;
+    }
+    unpresented = true;
+    for (i = 0; i < 2; i++) {
+        if (page_dirty[i].y0 >= page_dirty[i].y1) {
+            page_dirty[i].y0 = y;
+            page_dirty[i].y1 = y1;
+        } else {
+            page_dirty[i].y0 = min(page_dirty[i].y0, y);
+            page_dirty[i].y1 = max(page_dirty[i].y1, y1);
         }
     }
 }
 
-void draw_game(struct fb_info *info, int start_x, int start_y,
-                    int pixel_size, u32 color)
-{
-    int x = start_x;
+// Draw everything to fb from now on, directly where its format allows
+static void meteor_set_target(struct fb_info *fb) {
+    target = fb;
+    direct_fill = meteor_blit_init(&blit, fb) == 0;
+    if (!direct_fill) {
+        pr_info("No span fills for %u bpp, drawing with sys_fillrect", fb->var.bits_per_pixel);
+    }
+}
+
+// Draw a rectangle to the screen or the shadow buffer, whichever is the target
+void meteor_fill(int x, int y, int w, int h, u32 color) {
+    struct fb_fillrect rect;
+
+    if (direct_fill) {
+        meteor_blit_fill(&blit, x, y, w, h, color);
+    } else {
+        rect.dx = x;
+        rect.dy = y;
+        rect.width = w;
+        rect.height = h;
+        rect.color = color;
+        rect.rop = ROP_COPY;
+        sys_fillrect(target, &rect);
+    }
+    meteor_stat_inc(METEOR_STAT_FILLS);
+    meteor_stat_add(METEOR_STAT_PIXELS, w * h);
 
-    draw_char(info, G, x, start_y, pixel_size, color); x += 6 * pixel_size;
-    draw_char(info, A, x, start_y, pixel_size, color); x += 6 * pixel_size;
-    draw_char(info, M, x, start_y, pixel_size, color); x += 6 * pixel_size;
-    draw_char(info, E, x, start_y, pixel_size, color); x += 8 * pixel_size; // gap
+    if (target == &shadow_info) {
+        present_mark_dirty(y, h);
+    }
 }
 
-void draw_over(struct fb_info *info, int start_x, int start_y,
-                    int pixel_size, u32 color)
-{
-    int x = start_x;
+// Draw text centered on center_x, rasterized once and cached by meteor_text.c
+void meteor_text(int center_x, int y, int height, u32 color, const char *text) {
+    const struct fb_image *cached = meteor_text_render(text, height);
+    struct fb_image image;
+
+    if (!cached || cached->width > target->var.xres || y < 0 ||
+        y + cached->height > target->var.yres) {
+        return;
+    }
+    image = *cached;
+    image.dx = clamp_t(int, center_x - (int) image.width / 2, 0, target->var.xres - image.width);
+    image.dy = y;
+    image.fg_color = color;
+    image.bg_color = 0;     // palette black
+    sys_imageblit(target, &image);
+
+    if (target == &shadow_info) {
+        present_mark_dirty(y, image.height);
+    }
+}
 
-    draw_char(info, O, x, start_y, pixel_size, color); x += 6 * pixel_size;
-    draw_char(info, V, x, start_y, pixel_size, color); x += 6 * pixel_size;
-    draw_char(info, E, x, start_y, pixel_size, color); x += 6 * pixel_size;
-    draw_char(info, R, x, start_y, pixel_size, color);
+// Copy the rows of the shadow buffer that changed into a page of the framebuffer
+static void present_copy(int page) {
+    int y0 = page_dirty[page].y0;
+    int y1 = page_dirty[page].y1;
+    u32 line_length = info->fix.line_length;
+
+    if (y0 >= y1) {
+        return;
+    }
+    memcpy_toio(info->screen_base + (page * info->var.yres + y0) * line_length,
+                shadow_info.screen_base + y0 * line_length,
+                (y1 - y0) * line_length);
+    page_dirty[page].y0 = 0;
+    page_dirty[page].y1 = 0;
 }
 
-// meteor timer handler
-static void meteor_handler(struct timer_list *data) {
+// Present the frame composed in the shadow buffer, a no-op when drawing directly.
+// state_lock must be held.
+static void meteor_present(void) {
+    if (target != &shadow_info) {
+        return;
+    }
+    if (!page_flip) {
+        queue_work(system_highpri_wq, &present_work);
+        return;
+    }
 
-    // Move all meteors down a few pixels
-    mutex_lock(&meteor_mutex);
-    int i;
-    for (i=0; i<n_meteors; ) {
-        // Redraw meteor
-        new_meteor_position->dx = meteors[i]->dx;
-        new_meteor_position->dy = meteors[i]->dy + meteor_falling_rate;
-        new_meteor_position->width = meteors[i]->width;
-        new_meteor_position->height = meteors[i]->height;
-        redraw_meteor(meteors[i], new_meteor_position);
-
-        // Update meteor position in list
-        meteors[i]->dy = meteors[i]->dy + meteor_falling_rate;
-
-        // Delete meteor if it went past the screen
-        if (meteors[i]->dy > 280) {
-            printk(KERN_ALERT "Deleting meteor %d\n", i);
-            printk(KERN_ALERT "Number of meteors before deleting %d\n", n_meteors);
-            kfree(meteors[i]);
-            int j;
-            for (j=i; j<n_meteors-1; j++) {
-                meteors[j] = meteors[j+1];
-            }
-            n_meteors--;
-            printk(KERN_ALERT "Number of meteors after deleting %d\n", n_meteors);
-        } else {
-            i++;
-        }
+    // Until the last flip completed the back page may still be on screen, the
+    // rows stay dirty and go out with a later frame
+    if (flip_pending) {
+        return;
+    }
+    present_copy(!front_page);
+    unpresented = false;
+    flip_pending = true;
+    queue_work(system_highpri_wq, &present_work);
+}
+
+// Block until the next vertical blank where the driver supports it. The ioctl
+// reads the crtc index from a user pointer, so it is called the way fbmem would
+// but with the address limit lifted for a kernel one.
+static void meteor_wait_vsync(void) {
+    u32 crtc = 0;
+    mm_segment_t old_fs;
+
+    if (!info->fbops->fb_ioctl || !lock_fb_info(info)) {
+        return;
+    }
+    old_fs = get_fs();
+    set_fs(KERNEL_DS);
+    // Errors mean no vsync support, the frame just goes out unsynchronized
+    info->fbops->fb_ioctl(info, FBIO_WAITFORVSYNC, (unsigned long) &crtc);
+    set_fs(old_fs);
+    unlock_fb_info(info);
+}
+
+static int meteor_pan_to(u32 yoffset) {
+    struct fb_var_screeninfo var = info->var;
+    int ret;
+
+    var.yoffset = yoffset;
+    var.activate = FB_ACTIVATE_VBL;
+
+    // Same order as the FBIOPAN_DISPLAY ioctl in fbmem, console first
+    console_lock();
+    if (!lock_fb_info(info)) {
+        console_unlock();
+        return -ENODEV;
+    }
+    ret = fb_pan_display(info, &var);
+    unlock_fb_info(info);
+    console_unlock();
+    return ret;
+}
+
+// Runs in process context since panning and waiting for vblank can sleep
+static void meteor_present_work(struct work_struct *work) {
+    int back;
+
+    if (!page_flip) {
+        // One page only, copy what changed right after the blank
+        meteor_wait_vsync();
+        mutex_lock(&state_lock);
+        present_copy(0);
+        unpresented = false;
+        mutex_unlock(&state_lock);
+        return;
     }
-    mutex_unlock(&meteor_mutex);
 
-    // Restart timer
+    // meteor_present filled the hidden page, flip to it at the next vblank
+    back = !front_page;
+    if (meteor_pan_to(back * info->var.yres) != 0) {
+        pr_err("fb_pan_display failed, copying frames instead of flipping");
+        mutex_lock(&state_lock);
+        page_flip = false;
+        flip_pending = false;
+        present_mark_dirty(0, info->var.yres);
+        meteor_present();
+        mutex_unlock(&state_lock);
+        return;
+    }
+
+    // The old front page is only free once the flip has happened
+    meteor_wait_vsync();
+
+    mutex_lock(&state_lock);
+    front_page = back;
+    flip_pending = false;
+    if (unpresented) {
+        // Frames drawn while the flip was pending
+        meteor_present();
+    }
+    mutex_unlock(&state_lock);
+}
+
+// Set up the off-screen buffer frames are composed in when double_buffer is set
+static int meteor_shadow_init(void) {
+    u32 page_size = info->fix.line_length * info->var.yres;
+    void *buffer = vzalloc(page_size);
+
+    if (!buffer) {
+        return -ENOMEM;
+    }
+
+    // sys_fillrect only needs the format and memory of the target
+    shadow_info.var = info->var;
+    shadow_info.fix = info->fix;
+    shadow_info.fix.smem_len = page_size;
+    shadow_info.flags = info->flags;
+    shadow_info.state = info->state;
+    shadow_info.pseudo_palette = info->pseudo_palette;
+    shadow_info.fbops = info->fbops;
+    shadow_info.screen_base = (char __iomem *) buffer;
+    shadow_info.screen_size = page_size;
+
+    page_flip = info->fbops->fb_pan_display && info->fix.ypanstep &&
+                info->var.yres_virtual >= 2 * info->var.yres &&
+                info->fix.smem_len >= 2 * page_size;
+    saved_yoffset = info->var.yoffset;
+    front_page = 0;
+    present_mark_dirty(0, info->var.yres);
+
+    meteor_set_target(&shadow_info);
+    printk(KERN_INFO "Double buffering with %s\n", page_flip ? "page flips" : "vsync copies");
+    return 0;
+}
+
+static void meteor_shadow_exit(void) {
+    if (target != &shadow_info) {
+        return;
+    }
+    cancel_work_sync(&present_work);
+    if (page_flip && info->var.yoffset != saved_yoffset) {
+        meteor_pan_to(saved_yoffset);
+    }
+    meteor_set_target(info);
+    vfree((void __force *) shadow_info.screen_base);
+}
+
+// Queue an event for read(), state_lock must be held. The last free slot is
+// kept for the collision so that game over always gets through.
+void meteor_emit(u8 type, s32 arg) {
+    struct meteor_event event;
+
+    if (kfifo_avail(&event_fifo) <= 1 && type != METEOR_EVENT_COLLISION) {
+        meteor_stat_inc(METEOR_STAT_EVENTS_DROPPED);
+        return;
+    }
+
+    event.version = METEOR_DASH_VERSION;
+    event.type = type;
+    event.reserved = 0;
+    event.tick = meteor_tick;
+    event.arg = arg;
+    kfifo_put(&event_fifo, event);
+}
+
+// Schedule the next meteor tick, state_lock must be held
+static void meteor_arm_timer(void) {
+    tick_due = ktime_add_ms(ktime_get(), meteor_update_rate_ms);
     mod_timer(timer, jiffies + msecs_to_jiffies(meteor_update_rate_ms));
 }
 
+// meteor timer handler, the tick itself runs in process context
+static void meteor_handler(struct timer_list *data) {
+    queue_work(system_highpri_wq, &tick_work);
+}
+
+// One meteor tick. Lateness counts from when the timer was due to when the
+// tick runs, so it covers the workqueue as well as the timer.
+static void meteor_tick_work(struct work_struct *work) {
+    bool running;
+    bool steering;
+    ktime_t start = ktime_get();
+
+    meteor_hist_record(METEOR_HIST_TIMER_LATE_US, max_t(s64, ktime_us_delta(start, tick_due), 0));
+
+    mutex_lock(&state_lock);
+    if (!ticking) {
+        // Released after the timer fired
+        mutex_unlock(&state_lock);
+        return;
+    }
+    meteor_frame(true);
+    running = !game_over;
+    steering = imu_speed > 0;
+
+    // Restart timer, under the lock so release can stop it for good
+    if (running) {
+        meteor_arm_timer();
+    }
+    mutex_unlock(&state_lock);
+
+    meteor_stat_inc(METEOR_STAT_TICKS);
+    meteor_hist_record(METEOR_HIST_TICK_NS, ktime_to_ns(ktime_sub(ktime_get(), start)));
+
+    // Sample input in lockstep with the meteors
+    if (running && steering) {
+        queue_work(system_highpri_wq, &imu_work);
+    }
+}
+
+// Draws commands from write() as soon as they arrive instead of on the next tick
+static void meteor_input_work(struct work_struct *work) {
+    mutex_lock(&state_lock);
+    meteor_frame(false);
+    mutex_unlock(&state_lock);
+}
+
 // Device file functions
 static int __init meteor_init(void)
 {
     // Device file
     int registration;
+    int ret;
+
+    if (max_meteors < 1 || max_meteors > METEOR_MAX_CAPACITY) {
+        pr_err("max_meteors must be between 1 and %d", METEOR_MAX_CAPACITY);
+        return -EINVAL;
+    }
+
     registration = register_chrdev(61, "meteor_dash", &meteor_fops);
     if (registration < 0) { 
         pr_err("could not register device file");
         return registration;
     }
 
-    // Make memory for drawing rectangles
-    blank = kmalloc(sizeof(struct fb_fillrect), GFP_KERNEL);
-    if (!blank) {
-        printk(KERN_ALERT "could not allocate space for blank\n");
-        pr_err("Failed to allocate new blank pointer");
-        return -ENOMEM;
-    }
-
     // Allocate memory for the meteor timer
     timer = (struct timer_list *) kmalloc(sizeof(struct timer_list), GFP_KERNEL);
     if (!timer)
     {
         printk(KERN_ALERT "Insufficient kernel memory\n");
         pr_err("Failed to allocate new timer pointer");
-        kfree(blank);
-        return -ENOMEM;
+        ret = -ENOMEM;
+        goto fail_timer;
     }
 
-    // Allocate memory for a temporary meteor and character to update positions
-    new_meteor_position = kmalloc(sizeof(meteor_position_t), GFP_KERNEL);
-    if (!new_meteor_position) {
-        pr_err("Failed to allocate new meteor pointer");
-        kfree(blank);
-        kfree(timer);
-        return -ENOMEM;
+    // Pages shared with userspace through mmap
+    BUILD_BUG_ON(sizeof(struct meteor_ring) > PAGE_SIZE);
+    cmd_ring = (struct meteor_ring *) get_zeroed_page(GFP_KERNEL);
+    game_state = (struct meteor_state *) get_zeroed_page(GFP_KERNEL);
+    if (!cmd_ring || !game_state) {
+        pr_err("Failed to allocate shared pages");
+        ret = -ENOMEM;
+        goto fail_pages;
     }
 
-    new_character_position = kmalloc(sizeof(meteor_position_t), GFP_KERNEL);
-    if (!new_character_position) {
-        pr_err("Failed to allocate new character pointer");
-        kfree(blank);
-        kfree(timer);
-        kfree(new_meteor_position);
-        return -ENOMEM;
+    meteor_stats_init();
+    if (meteor_text_init() != 0) {
+        pr_err("No console font built in, drawing the game over screen without text");
     }
 
-    // Meteor array mutex
-    mutex_init(&meteor_mutex);
+    INIT_WORK(&tick_work, meteor_tick_work);
+    INIT_WORK(&input_work, meteor_input_work);
+
+    // The game can still be steered from userspace without the sensor
+    INIT_WORK(&imu_work, meteor_imu_work);
+    if (kernel_imu && meteor_imu_init() != 0) {
+        pr_err("Failed to register IMU driver, steering from userspace only");
+    }
 
     // Initialize framebuffer info
     info = get_fb_info(0);
+    if (IS_ERR_OR_NULL(info)) {
+        pr_err("No framebuffer to draw on");
+        ret = info ? PTR_ERR(info) : -ENODEV;
+        info = NULL;
+        goto fail_fb;
+    }
+    meteor_set_target(info);
+    ret = meteor_engine_init(info->var.xres, info->var.yres, max_meteors);
+    if (ret != 0) {
+        pr_err("Failed to allocate room for %d meteors", max_meteors);
+        goto fail_engine;
+    }
+    INIT_WORK(&present_work, meteor_present_work);
+    if (double_buffer && meteor_shadow_init() != 0) {
+        pr_err("Failed to allocate shadow framebuffer, drawing directly");
+    }
 
     printk(KERN_INFO "Module initialized!\n");
 
     return 0;
+
+fail_engine:
+    atomic_dec(&info->count);
+    info = NULL;
+fail_fb:
+    meteor_imu_exit();
+    meteor_text_exit();
+    meteor_stats_exit();
+fail_pages:
+    free_page((unsigned long) cmd_ring);
+    free_page((unsigned long) game_state);
+    kfree(timer);
+fail_timer:
+    unregister_chrdev(61, "meteor_dash");
+    return ret;
 }
 
 static void __exit meteor_exit(void) {
-    int i;
-    for (i = 0; i < n_meteors; i++) {
-        if (meteors[i]) {
-            kfree(meteors[i]);
-            meteors[i] = NULL; // Best practice
-        }
-    }
-    n_meteors = 0;
+    meteor_imu_exit();
+    meteor_stats_exit();
+    meteor_engine_exit();
+    meteor_text_exit();
+    meteor_shadow_exit();
 
-    kfree(blank);
     kfree(timer);
-    kfree(new_meteor_position);
-    kfree(new_character_position);
+    free_page((unsigned long) cmd_ring);
+    free_page((unsigned long) game_state);
     if (info) {
         atomic_dec(&info->count);
     }
@@ -389,205 +571,367 @@ static void __exit meteor_exit(void) {
 static int meteor_open(struct inode *inode, struct file *filp) {
     printk(KERN_ALERT "Opening the file!\n");
 
-    // start the timer
-    timer_setup(timer, meteor_handler, 0);
-    mod_timer(timer, jiffies + msecs_to_jiffies(meteor_update_rate_ms));
-    printk(KERN_ALERT "Started the timer!\n");
+    // start a new game, dropping anything left over from the last one
+    mutex_lock(&state_lock);
+    imu_speed = 0;
+    // Writers on another fd may be queueing, the reset moves in as well as out
+    spin_lock(&input_lock);
+    kfifo_reset(&input_fifo);
+    spin_unlock(&input_lock);
+    cmd_ring->tail = READ_ONCE(cmd_ring->head);
+    meteor_tick = 0;
+    write_seqlock(&state_seqlock);
+    memset(&published_state, 0, sizeof(published_state));
+    write_sequnlock(&state_seqlock);
+    spin_lock(&event_lock);
+    kfifo_reset(&event_fifo);
+    spin_unlock(&event_lock);
+    memset(game_state, 0, sizeof(*game_state));
 
     // add the character
-    character = kmalloc(sizeof(meteor_position_t), GFP_KERNEL);
-    printk(KERN_ALERT "drawing the character\n");
-    if (!character) {
-        pr_err("Failed to allocate new character pointer");
-        return -ENOMEM;
-    }
-    character->dx = 250;
-    character->dy = 250;
-    character->width = 20;
-    character->height = 20;
-
-    blank->dx = character->dx;
-    blank->dy = character->dy;
-    blank->width = character->width;
-    blank->height = character->height;
-    blank->color = CYG_FB_DEFAULT_PALETTE_LIGHTBLUE;
-    blank->rop = ROP_COPY;
-    lock_fb_info(info);
-    sys_fillrect(info, blank);
-    unlock_fb_info(info);
-
+    meteor_new_game();
+    meteor_present();
     printk(KERN_ALERT "Added the character!");
 
+    // start the timer
+    timer_setup(timer, meteor_handler, 0);
+    ticking = true;
+    meteor_arm_timer();
+    mutex_unlock(&state_lock);
+    printk(KERN_ALERT "Started the timer!\n");
+
     return 0;
 }
 
 static int meteor_release(struct inode *inode, struct file *filp) {
     printk(KERN_ALERT "Releasing the file!\n");
+    // A tick already running sees ticking cleared before it can re-arm
+    mutex_lock(&state_lock);
+    ticking = false;
+    mutex_unlock(&state_lock);
     del_timer_sync(timer);
-    kfree(character);
-    int i;
-    for (i = 0; i < n_meteors; i++) {
-        if (meteors[i]) {
-            kfree(meteors[i]);
-            meteors[i] = NULL; // Best practice
+    cancel_work_sync(&tick_work);
+    cancel_work_sync(&imu_work);
+    cancel_work_sync(&input_work);
+    flush_work(&present_work); // let the last frame reach the screen
+
+    mutex_lock(&state_lock);
+    meteor_engine_reset();
+    mutex_unlock(&state_lock);
+    return 0;
+}
+
+
+// Hand out whole event records, blocking until there is one unless O_NONBLOCK
+static ssize_t meteor_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos) {
+    struct meteor_event events[METEOR_MAX_BATCH];
+    unsigned int n_events;
+    int ret;
+
+    if (count < sizeof(events[0])) {
+        return -EINVAL;
+    }
+    count = min(count, sizeof(events));
+
+    for (;;) {
+        spin_lock(&event_lock);
+        n_events = kfifo_out(&event_fifo, events, count / sizeof(events[0]));
+        spin_unlock(&event_lock);
+        if (n_events > 0) {
+            break;
+        }
+
+        if (filp->f_flags & O_NONBLOCK) {
+            return -EAGAIN;
         }
+        ret = wait_event_interruptible(event_wait, !kfifo_is_empty(&event_fifo));
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    if (copy_to_user(buf, events, n_events * sizeof(events[0]))) {
+        return -EFAULT;
     }
-    n_meteors = 0;
-    meteor_color_idx = 0;
+    return n_events * sizeof(events[0]);
 }
 
+static __poll_t meteor_poll(struct file *filp, poll_table *wait) {
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
 
-static ssize_t meteor_read(struct file *filp, char *buf, size_t count, loff_t *f_pos) {
+    poll_wait(filp, &event_wait, wait);
+    if (!kfifo_is_empty(&event_fifo)) {
+        mask |= EPOLLIN | EPOLLRDNORM;
+    }
+    return mask;
 }
 
-static ssize_t meteor_write(struct file *filp, const char *buf, size_t count, loff_t *f_pos) {
-    // Read from userspace
-    char buffer[8];
+// Check a command before it is applied, write() does this before queueing so
+// that bad commands fail synchronously
+static int meteor_check_cmd(const struct meteor_cmd *cmd) {
+    if (cmd->version != METEOR_DASH_VERSION || cmd->reserved != 0) {
+        return -EINVAL;
+    }
+
+    switch (cmd->opcode) {
+    case METEOR_CMD_SET_FALL_RATE:
+        return (cmd->arg > 0 && cmd->arg < METEOR_SCREEN_HEIGHT) ? 0 : -EINVAL;
+    case METEOR_CMD_SET_CHAR_X:
+        return (cmd->arg >= 0 && cmd->arg <= METEOR_SCREEN_WIDTH - METEOR_CHARACTER_SIZE) ? 0 : -EINVAL;
+    case METEOR_CMD_SPAWN:
+        return (cmd->arg >= 0 && cmd->arg <= METEOR_SCREEN_WIDTH - meteor_size) ? 0 : -EINVAL;
+    case METEOR_CMD_SET_INPUT:
+        if (cmd->arg < 0 || cmd->arg > METEOR_MAX_INPUT_SPEED) {
+            return -EINVAL;
+        }
+        return (cmd->arg == 0 || meteor_imu_present()) ? 0 : -ENODEV;
+    case METEOR_CMD_SET_SCORE:
+    case METEOR_CMD_SET_LEVEL:
+        return cmd->arg >= 0 ? 0 : -EINVAL;
+    default:
+        return -EINVAL;
+    }
+}
+
+// Commands the module handles itself, the engine applies the rest
+static void meteor_apply(const struct meteor_cmd *cmd, struct meteor_batch *batch) {
+    if (cmd->opcode != METEOR_CMD_SET_INPUT) {
+        meteor_apply_cmd(cmd, batch);
+        return;
+    }
+    if (cmd->arg > 0 && imu_speed == 0) {
+        WRITE_ONCE(imu_restart, true);
+    }
+    WRITE_ONCE(imu_speed, cmd->arg);
+}
+
+// Apply everything queued through write() and the shared ring, state_lock must be held
+static void meteor_drain_input(struct meteor_batch *batch) {
+    struct meteor_cmd cmd;
+    u32 head;
+    u32 tail;
+
+    // Commands from write() were checked before they were queued
+    while (kfifo_get(&input_fifo, &cmd)) {
+        meteor_apply(&cmd, batch);
+    }
+
+    // Pairs with the release store of head in userspace
+    head = smp_load_acquire(&cmd_ring->head);
+    tail = cmd_ring->tail;
+    if (head - tail > METEOR_RING_SIZE) {
+        // head was corrupted by userspace, drop everything
+        tail = head;
+    }
+    for (; tail != head; tail++) {
+        // Copy the slot first, userspace can still write to the page
+        memcpy(&cmd, &cmd_ring->cmds[tail & (METEOR_RING_SIZE - 1)], sizeof(cmd));
+        if (meteor_check_cmd(&cmd) == 0) {
+            meteor_apply(&cmd, batch);
+        }
+    }
+
+    // Let userspace reuse the slots
+    smp_store_release(&cmd_ring->tail, tail);
+}
+
+// Publish the state write() and userspace look at, state_lock must be held
+static void meteor_publish_state(void) {
+    write_seqlock(&state_seqlock);
+    published_state.tick = meteor_tick;
+    published_state.n_meteors = n_meteors;
+    published_state.collision = game_over;
+    published_state.character_x = character.dx;
+    write_sequnlock(&state_seqlock);
+
+    // Same protocol for the mmap'd page, seq is odd while it is being updated
+    WRITE_ONCE(game_state->seq, game_state->seq + 1);
+    smp_wmb();
+    WRITE_ONCE(game_state->tick, published_state.tick);
+    WRITE_ONCE(game_state->n_meteors, published_state.n_meteors);
+    WRITE_ONCE(game_state->collision, published_state.collision);
+    WRITE_ONCE(game_state->character_x, published_state.character_x);
+    smp_wmb();
+    WRITE_ONCE(game_state->seq, game_state->seq + 1);
+}
+
+// One render pass, state_lock must be held
+static void meteor_frame(bool tick) {
+    struct meteor_batch batch;
+
+    if (game_over) {
+        // Nothing moves any more, drop whatever input is still coming in
+        kfifo_reset_out(&input_fifo);
+        smp_store_release(&cmd_ring->tail, smp_load_acquire(&cmd_ring->head));
+        return;
+    }
+
+    // Every event of a tick, despawns included, carries its number
+    if (tick) {
+        meteor_tick++;
+    }
+    meteor_begin_batch(&batch, tick);
+    meteor_drain_input(&batch);
+    meteor_end_batch(&batch, tick);
+    meteor_present();
+    meteor_publish_state();
+
+    if (tick) {
+        meteor_emit(METEOR_EVENT_TICK, n_meteors);
+    }
+    if (!kfifo_is_empty(&event_fifo)) {
+        wake_up_interruptible(&event_wait);
+    }
+}
+
+static void meteor_read_state(struct meteor_state *state) {
+    unsigned int seq;
+    do {
+        seq = read_seqbegin(&state_seqlock);
+        *state = published_state;
+    } while (read_seqretry(&state_seqlock, seq));
+}
+
+// Queue checked commands for the next render pass as a whole
+static int meteor_queue_input(const struct meteor_cmd *cmds, size_t n_cmds) {
+    spin_lock(&input_lock);
+    if (kfifo_avail(&input_fifo) < n_cmds) {
+        spin_unlock(&input_lock);
+        return -EAGAIN;
+    }
+    kfifo_in(&input_fifo, cmds, n_cmds);
+    spin_unlock(&input_lock);
+
+    queue_work(system_highpri_wq, &input_work);
+    return 0;
+}
+
+// Sample the IMU and steer the character. Queued by the tick, runs in process
+// context since I2C transfers sleep.
+static void meteor_imu_work(struct work_struct *work) {
+    struct meteor_cmd cmd;
+    imu_raw_t raw;
+    ktime_t now;
+    s32 dt_us;
+    int speed = READ_ONCE(imu_speed);
     int ret;
-    ret = copy_from_user(&buffer, buf, count);
+
+    if (speed == 0) {
+        return;
+    }
+    ret = meteor_imu_read(&raw);
     if (ret != 0) {
-        pr_err("failed to copy bytes from userspace\n");
-        return -EFAULT;
+        pr_err("Failed to read IMU: %d", ret);
+        return;
     }
+    now = ktime_get();
+
+    // Steering was just enabled, start from where the character is with the
+    // bias measured at probe
+    if (READ_ONCE(imu_restart)) {
+        WRITE_ONCE(imu_restart, false);
+        imu_filter_init_calibrated(&imu_filter, meteor_imu_gyro_bias(), &raw);
+        mutex_lock(&state_lock);
+        imu_character_mpx = character.dx * 1000;
+        mutex_unlock(&state_lock);
+        imu_last_sample = now;
+    }
+    dt_us = min_t(s64, ktime_us_delta(now, imu_last_sample), IMU_FILTER_MAX_DT_US);
+    imu_last_sample = now;
+
+    imu_filter_update(&imu_filter, &raw, dt_us);
+
+    // Tilt sets the velocity
+    imu_character_mpx += div_s64((s64)imu_filter.tilt_mdeg * METEOR_TILT_SPEED * speed * dt_us,
+                                 METEOR_STEP_MS * 1000 * 1000);
+    imu_character_mpx = clamp_t(s32, imu_character_mpx, 0,
+                                (METEOR_SCREEN_WIDTH - METEOR_CHARACTER_SIZE) * 1000);
+
+    cmd.version = METEOR_DASH_VERSION;
+    cmd.opcode = METEOR_CMD_SET_CHAR_X;
+    cmd.reserved = 0;
+    cmd.arg = imu_character_mpx / 1000;
+    meteor_queue_input(&cmd, 1);
+}
+
+// The batch is queued for the next render pass as a whole, the writer never
+// waits for drawing
+static ssize_t meteor_write_cmds(struct iov_iter *from) {
+    struct meteor_cmd cmds[METEOR_MAX_BATCH];
+    struct meteor_state state;
+    size_t count = iov_iter_count(from);
+    size_t n_cmds;
+    size_t i;
+    int ret;
 
-    // Parse message
-    char *temp_str;
-    char *character_location;
-    char *spawn_location;
-    int character_x;
-    int spawn_x;
-    const char *delimiter = ",";
-    temp_str = buffer;
-    character_location = strsep(&temp_str, delimiter);
-    spawn_location = strsep(&temp_str, delimiter);
+    // A whole number of fixed-size commands per write
+    if (count == 0 || count % sizeof(cmds[0]) != 0 || count > sizeof(cmds)) {
+        return -EINVAL;
+    }
+    n_cmds = count / sizeof(cmds[0]);
 
-    // Cast to int
-    ret = kstrtoint(character_location, 10, &character_x);
-    if (ret < 0) {
-        pr_err("Failed to parse character to int\n");
+    // Read from userspace
+    if (copy_from_iter(cmds, count, from) != count) {
+        pr_err("failed to copy bytes from userspace\n");
+        return -EFAULT;
     }
-    ret = kstrtoint(spawn_location, 10, &spawn_x);
-    if (ret < 0) {
-        pr_err("Failed to parse spawn to int\n");
+
+    for (i = 0; i < n_cmds; i++) {
+        ret = meteor_check_cmd(&cmds[i]);
+        if (ret != 0) {
+            return ret;
+        }
     }
 
-    // Bounds checking for security
-    if (character_x > 500 || spawn_x > 500) {
-        return count;
+    meteor_read_state(&state);
+    if (state.collision) {
+        return -2;
     }
 
-    mutex_lock(&meteor_mutex);
-    if (character_x < 0 && spawn_x < 280) {
-        // Increase meteor spawn rate
-        meteor_falling_rate = spawn_x;
+    ret = meteor_queue_input(cmds, n_cmds);
+    return ret != 0 ? ret : count;
+}
 
-        // Update meteor color
-        meteor_color_idx++;
-        if (meteor_color_idx >= n_meteor_colors) {
-            meteor_color_idx = 0;
-        }
-        meteor_color = meteor_colors[meteor_color_idx];
-    } else {
-        // Redraw the character
-        new_character_position->dx = character_x;
-        new_character_position->dy = 250;
-        new_character_position->width = 20;
-        new_character_position->height = 20;
-        redraw_character(character, new_character_position);
-        character->dx = character_x;
-
-        // Check if there is a collision
-        int i;
-        int meteor_x;
-        int meteor_y;
-        for (i=0; i<n_meteors; i++) {
-            meteor_x = meteors[i]->dx;
-            meteor_y = meteors[i]->dy;
-            int x_difference = character_x - meteor_x;
-            if (meteor_y > 280 - (meteor_size + 31)) {
-                if (x_difference > -20 && x_difference < meteor_size) {
-                    printk(KERN_ALERT "Collision detected\n");
-
-                    // Redraw screen to black
-                    meteor_position_t *new_position = kmalloc(sizeof(meteor_position_t), GFP_KERNEL);
-                    if (!new_position) {
-                        pr_err("Failed to allocate new meteor pointer");
-                        mutex_unlock(&meteor_mutex);
-                        return -ENOMEM;
-                    }
-                    new_position->dx = 0;
-                    new_position->dy = 0;
-                    new_position->width = 500;
-                    new_position->height = 280;
-
-                    blank->dx = new_position->dx;
-                    blank->dy = new_position->dy;
-                    blank->width = new_position->width;
-                    blank->height = new_position->height;
-                    blank->color = CYG_FB_DEFAULT_PALETTE_BLACK;
-                    blank->rop = ROP_COPY;
-                    sys_fillrect(info, blank);
-
-                    draw_game(info, 100, 25, 10, CYG_FB_DEFAULT_PALETTE_WHITE);
-                    draw_over(info, 100, 120, 10, CYG_FB_DEFAULT_PALETTE_WHITE);
-                    mutex_unlock(&meteor_mutex);
-                    return -2;
-                }
-            }
-        }
+// Handles both write() and writev()
+static ssize_t meteor_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    ktime_t start = ktime_get();
+    size_t count = iov_iter_count(from);
+    ssize_t ret;
+
+    ret = meteor_write_cmds(from);
 
-        // Add a new meteor
-        if (spawn_x > 0) {
-            if (n_meteors < 32) {
-                // Check if a meteor is colliding with another meteor
-                for (i=0; i<n_meteors; i++) {
-                    meteor_x = meteors[i]->dx;
-                    meteor_y = meteors[i]->dy;
-                    int x_difference = spawn_x - meteor_x;
-                    if (meteor_y < meteor_size) {
-                        if (x_difference > -meteor_size && x_difference < meteor_size) {
-                            printk(KERN_ALERT "Meteor spawned at x=%d is in collision with another meteor", spawn_x);
-                            mutex_unlock(&meteor_mutex);
-                            return count;
-                        }
-                    }
-                }
-
-                printk(KERN_ALERT "drawing new meteor at %d\n", spawn_x);
-                printk(KERN_ALERT "Number of meteors before adding %d\n", n_meteors);
-                meteor_position_t *new_position = kmalloc(sizeof(meteor_position_t), GFP_KERNEL);
-                if (!new_position) {
-                    pr_err("Failed to allocate new meteor pointer");
-                    mutex_unlock(&meteor_mutex);
-                    return -ENOMEM;
-                }
-                new_position->dx = spawn_x;
-                new_position->dy = 0;
-                new_position->width = meteor_size;
-                new_position->height = meteor_size;
-
-                blank->dx = new_position->dx;
-                blank->dy = new_position->dy;
-                blank->width = new_position->width;
-                blank->height = new_position->height;
-                blank->color = meteor_color;
-                blank->rop = ROP_COPY;
-                sys_fillrect(info, blank);
-
-                meteors[n_meteors] = new_position;
-                n_meteors ++;
-
-                printk(KERN_ALERT "Number of meteors after adding %d\n", n_meteors);
-            } else {
-                printk(KERN_ALERT "reached max number of meteors, skipping this creation\n");
-            }
+    meteor_stat_inc(METEOR_STAT_WRITES);
+    meteor_stat_add(METEOR_STAT_WRITE_BYTES, count);
+    meteor_hist_record(METEOR_HIST_WRITE_NS, ktime_to_ns(ktime_sub(ktime_get(), start)));
+    return ret;
+}
+
+static int meteor_mmap(struct file *filp, struct vm_area_struct *vma) {
+    void *page;
+
+    if (vma->vm_end - vma->vm_start != PAGE_SIZE) {
+        return -EINVAL;
+    }
+
+    switch (vma->vm_pgoff) {
+    case METEOR_MMAP_RING_PGOFF:
+        page = cmd_ring;
+        break;
+    case METEOR_MMAP_STATE_PGOFF:
+        // The game state is read-only for userspace
+        if (vma->vm_flags & VM_WRITE) {
+            return -EPERM;
         }
+        vma->vm_flags &= ~VM_MAYWRITE;
+        page = game_state;
+        break;
+    default:
+        return -EINVAL;
     }
 
-    mutex_unlock(&meteor_mutex);
-    return count;
+    return remap_pfn_range(vma, vma->vm_start, virt_to_phys(page) >> PAGE_SHIFT,
+                           PAGE_SIZE, vma->vm_page_prot);
 }
 
 module_init(meteor_init);
 module_exit(meteor_exit);
-
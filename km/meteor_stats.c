@@ -0,0 +1,106 @@
+#include <linux/kernel.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include <linux/uaccess.h>
+
+#include "meteor_stats.h"
+
+// Counters and histograms under /sys/kernel/debug/meteor_dash. Writing
+// anything to the reset file zeroes all of them.
+
+atomic64_t meteor_counters[METEOR_N_COUNTERS];
+static atomic64_t meteor_histograms[METEOR_N_HISTOGRAMS][METEOR_HIST_BUCKETS];
+static struct dentry *stats_dir;
+
+static const char *const counter_names[METEOR_N_COUNTERS] = {
+    [METEOR_STAT_TICKS] = "ticks",
+    [METEOR_STAT_FILLS] = "fills",
+    [METEOR_STAT_PIXELS] = "pixels",
+    [METEOR_STAT_SPAWNS] = "spawns",
+    [METEOR_STAT_SPAWN_REJECTS] = "spawn_rejects",
+    [METEOR_STAT_DESPAWNS] = "despawns",
+    [METEOR_STAT_COLLISIONS] = "collisions",
+    [METEOR_STAT_WRITES] = "writes",
+    [METEOR_STAT_WRITE_BYTES] = "write_bytes",
+    [METEOR_STAT_EVENTS_DROPPED] = "events_dropped",
+};
+
+static const char *const histogram_names[METEOR_N_HISTOGRAMS] = {
+    [METEOR_HIST_TICK_NS] = "tick_ns",
+    [METEOR_HIST_WRITE_NS] = "write_ns",
+    [METEOR_HIST_TIMER_LATE_US] = "timer_late_us",
+};
+
+void meteor_hist_record(enum meteor_histogram hist, u64 value) {
+    int bucket = value ? min_t(int, ilog2(value) + 1, METEOR_HIST_BUCKETS - 1) : 0;
+    atomic64_inc(&meteor_histograms[hist][bucket]);
+}
+
+static int counters_show(struct seq_file *m, void *v) {
+    int i;
+
+    for (i = 0; i < METEOR_N_COUNTERS; i++) {
+        seq_printf(m, "%-16s %lld\n", counter_names[i], atomic64_read(&meteor_counters[i]));
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(counters);
+
+// One line per non-empty bucket: lower bound, upper bound, count
+static int histograms_show(struct seq_file *m, void *v) {
+    long long count;
+    int i;
+    int bucket;
+
+    for (i = 0; i < METEOR_N_HISTOGRAMS; i++) {
+        seq_printf(m, "%s:\n", histogram_names[i]);
+        for (bucket = 0; bucket < METEOR_HIST_BUCKETS; bucket++) {
+            count = atomic64_read(&meteor_histograms[i][bucket]);
+            if (count == 0) {
+                continue;
+            }
+            seq_printf(m, "  %10llu - %-10llu %lld\n",
+                       bucket ? 1ULL << (bucket - 1) : 0, (1ULL << bucket) - 1, count);
+        }
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(histograms);
+
+static ssize_t reset_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos) {
+    int i;
+    int bucket;
+
+    for (i = 0; i < METEOR_N_COUNTERS; i++) {
+        atomic64_set(&meteor_counters[i], 0);
+    }
+    for (i = 0; i < METEOR_N_HISTOGRAMS; i++) {
+        for (bucket = 0; bucket < METEOR_HIST_BUCKETS; bucket++) {
+            atomic64_set(&meteor_histograms[i][bucket], 0);
+        }
+    }
+    return count;
+}
+
+static const struct file_operations reset_fops = {
+    .owner = THIS_MODULE,
+    .write = reset_write,
+};
+
+// Statistics are best effort, the game runs without debugfs
+void meteor_stats_init(void) {
+    stats_dir = debugfs_create_dir("meteor_dash", NULL);
+    if (IS_ERR_OR_NULL(stats_dir)) {
+        stats_dir = NULL;
+        return;
+    }
+    debugfs_create_file("counters", 0444, stats_dir, NULL, &counters_fops);
+    debugfs_create_file("histograms", 0444, stats_dir, NULL, &histograms_fops);
+    debugfs_create_file("reset", 0200, stats_dir, NULL, &reset_fops);
+}
+
+void meteor_stats_exit(void) {
+    debugfs_remove_recursive(stats_dir);
+    stats_dir = NULL;
+}
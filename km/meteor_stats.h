@@ -0,0 +1,63 @@
+#ifndef METEOR_STATS_H
+#define METEOR_STATS_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/atomic.h>
+#else
+#include "kcompat.h"
+#endif
+
+// Event counters, cheap enough for the hot paths, see meteor_stats.c
+enum meteor_counter {
+    METEOR_STAT_TICKS,
+    METEOR_STAT_FILLS,
+    METEOR_STAT_PIXELS,
+    METEOR_STAT_SPAWNS,
+    METEOR_STAT_SPAWN_REJECTS,
+    METEOR_STAT_DESPAWNS,
+    METEOR_STAT_COLLISIONS,
+    METEOR_STAT_WRITES,
+    METEOR_STAT_WRITE_BYTES,
+    METEOR_STAT_EVENTS_DROPPED,
+    METEOR_N_COUNTERS,
+};
+
+// Latency histograms, bucket i counts values in [2^(i-1), 2^i)
+enum meteor_histogram {
+    METEOR_HIST_TICK_NS,
+    METEOR_HIST_WRITE_NS,
+    METEOR_HIST_TIMER_LATE_US,
+    METEOR_N_HISTOGRAMS,
+};
+#define METEOR_HIST_BUCKETS 32
+
+#ifdef __KERNEL__
+extern atomic64_t meteor_counters[METEOR_N_COUNTERS];
+
+static inline void meteor_stat_add(enum meteor_counter counter, u64 n) {
+    atomic64_add(n, &meteor_counters[counter]);
+}
+
+static inline void meteor_stat_inc(enum meteor_counter counter) {
+    atomic64_inc(&meteor_counters[counter]);
+}
+
+void meteor_stats_init(void);
+void meteor_stats_exit(void);
+#else
+// The simulator is single threaded and keeps its own counters
+extern u64 meteor_counters[METEOR_N_COUNTERS];
+
+static inline void meteor_stat_add(enum meteor_counter counter, u64 n) {
+    meteor_counters[counter] += n;
+}
+
+static inline void meteor_stat_inc(enum meteor_counter counter) {
+    meteor_counters[counter]++;
+}
+#endif
+
+void meteor_hist_record(enum meteor_histogram hist, u64 value);
+
+#endif
@@ -0,0 +1,130 @@
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/font.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#endif
+
+#include "meteor_dash.h"
+#include "meteor_text.h"
+
+// Text is drawn with one of the kernel's console fonts, scaled up by whole
+// pixels. A string is rasterized once per height into a 1 bpp image and kept,
+// so drawing it again is a single imageblit that also applies the color.
+
+// Room for the HUD characters and the game over screen
+#define TEXT_CACHE_SIZE 32
+#define TEXT_MAX_LEN 32
+
+struct text_entry {
+    char text[TEXT_MAX_LEN + 1];
+    int height;
+    unsigned long last_used;
+    struct fb_image image;
+};
+
+static const struct font_desc *font;
+static struct text_entry text_cache[TEXT_CACHE_SIZE];
+static unsigned long text_clock;
+
+int meteor_text_init(void) {
+    // Whichever built-in font the console would pick for the playfield
+    font = get_default_font(METEOR_SCREEN_WIDTH, METEOR_SCREEN_HEIGHT, ~0U, ~0U);
+    return font ? 0 : -ENODEV;
+}
+
+void meteor_text_exit(void) {
+    int i;
+
+    for (i = 0; i < TEXT_CACHE_SIZE; i++) {
+        kfree(text_cache[i].image.data);
+        text_cache[i].image.data = NULL;
+    }
+}
+
+// Set a run of n bits starting at bit x of a 1 bpp line, most significant bit first
+static void set_bits(u8 *line, int x, int n) {
+    for (; n > 0; n--, x++) {
+        line[x / 8] |= 0x80 >> (x % 8);
+    }
+}
+
+// Rasterize text into entry at the largest whole scale that fits in height
+static int text_rasterize(struct text_entry *entry, const char *text, int height) {
+    int len = strlen(text);
+    int scale = max_t(int, height / font->height, 1);
+    int glyph_pitch = DIV_ROUND_UP(font->width, 8);
+    int glyph_size = glyph_pitch * font->height;
+    int width = len * font->width * scale;
+    int pitch = DIV_ROUND_UP(width, 8);
+    const u8 *glyph;
+    u8 *data;
+    u8 *line;
+    int row;
+    int col;
+    int i;
+    int k;
+
+    // Render passes hold a spinlock, and a miss only happens on a new string
+    data = kzalloc(pitch * font->height * scale, GFP_ATOMIC);
+    if (!data) {
+        return -ENOMEM;
+    }
+
+    for (row = 0; row < font->height; row++) {
+        line = data + row * scale * pitch;
+        for (i = 0; i < len; i++) {
+            glyph = (const u8 *) font->data + (u8) text[i] * glyph_size + row * glyph_pitch;
+            for (col = 0; col < font->width; col++) {
+                if (glyph[col / 8] & (0x80 >> (col % 8))) {
+                    set_bits(line, (i * font->width + col) * scale, scale);
+                }
+            }
+        }
+        // A font row is scale lines high, all the same
+        for (k = 1; k < scale; k++) {
+            memcpy(line + k * pitch, line, pitch);
+        }
+    }
+
+    kfree(entry->image.data);
+    strscpy(entry->text, text, sizeof(entry->text));
+    entry->height = height;
+    memset(&entry->image, 0, sizeof(entry->image));
+    entry->image.width = width;
+    entry->image.height = font->height * scale;
+    entry->image.depth = 1;
+    entry->image.data = (const char *) data;
+    return 0;
+}
+
+// The 1 bpp image of text at the given height, NULL if there is no font or
+// memory. The caller fills in the position and colors of a copy.
+const struct fb_image *meteor_text_render(const char *text, int height) {
+    struct text_entry *entry = &text_cache[0];
+    int i;
+
+    if (!font || strlen(text) > TEXT_MAX_LEN) {
+        return NULL;
+    }
+
+    for (i = 0; i < TEXT_CACHE_SIZE; i++) {
+        if (text_cache[i].image.data && text_cache[i].height == height &&
+            strcmp(text_cache[i].text, text) == 0) {
+            entry = &text_cache[i];
+            entry->last_used = ++text_clock;
+            return &entry->image;
+        }
+        // Otherwise reuse an empty slot or the least recently used one
+        if (!text_cache[i].image.data ||
+            (entry->image.data && text_cache[i].last_used < entry->last_used)) {
+            entry = &text_cache[i];
+        }
+    }
+
+    if (text_rasterize(entry, text, height) != 0) {
+        return NULL;
+    }
+    entry->last_used = ++text_clock;
+    return &entry->image;
+}
@@ -0,0 +1,15 @@
+#ifndef METEOR_TEXT_H
+#define METEOR_TEXT_H
+
+#ifdef __KERNEL__
+#include <linux/fb.h>
+#else
+#include "kcompat.h"
+#endif
+
+// Strings rasterized from a kernel console font, see meteor_text.c
+int meteor_text_init(void);
+void meteor_text_exit(void);
+const struct fb_image *meteor_text_render(const char *text, int height);
+
+#endif
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// The engine is built into the benchmark so its static helpers can be timed
+// one at a time
+#include "meteor_engine.c"
+
+#include "imu_driver.h"
+#include "meteor_text.h"
+
+// Microbenchmarks of the engine's hot paths. Each case repeats one operation
+// until it has run for at least the minimum time, then prints a CSV row:
+//
+//   name,meteors,fall_rate,ops,ns_per_op,ops_per_sec
+//
+// meteors and fall_rate are 0 where they do not apply. Output is meant to be
+// diffed or plotted across commits, progress and errors go to stderr.
+
+#define NS_PER_SEC (1000 * 1000 * 1000LL)
+#define DEFAULT_MIN_TIME_MS 100
+
+static const int meteor_counts[] = {8, 32, 128, 512, 2048, 4096};
+static const int fall_rates[] = {1, 4, 16};
+#define N_METEOR_COUNTS (int)(sizeof(meteor_counts) / sizeof(meteor_counts[0]))
+#define N_FALL_RATES (int)(sizeof(fall_rates) / sizeof(fall_rates[0]))
+
+static u8 framebuffer[METEOR_SCREEN_HEIGHT][METEOR_SCREEN_WIDTH];
+u64 meteor_counters[METEOR_N_COUNTERS];
+
+static long long min_time_ns = DEFAULT_MIN_TIME_MS * 1000 * 1000LL;
+static const char *filter = NULL;
+
+static int n_populated;
+
+// Keeps results alive so the compiler cannot drop the work
+static volatile long long sink;
+
+void meteor_fill(int x, int y, int w, int h, u32 color) {
+    int x1 = min(x + w, METEOR_SCREEN_WIDTH);
+    int y1 = min(y + h, METEOR_SCREEN_HEIGHT);
+
+    x = max(x, 0);
+    y = max(y, 0);
+    for (; y < y1; y++) {
+        memset(&framebuffer[y][x], color, max(x1 - x, 0));
+    }
+}
+
+// Draw text centered on center_x from the module's text cache, with the same
+// clipping and black background as its imageblit
+void meteor_text(int center_x, int y, int height, u32 color, const char *text) {
+    const struct fb_image *image = meteor_text_render(text, height);
+    const u8 *line;
+    int pitch;
+    int x0;
+    int row;
+    int col;
+
+    if (!image || image->width > METEOR_SCREEN_WIDTH || y < 0 ||
+        y + image->height > METEOR_SCREEN_HEIGHT) {
+        return;
+    }
+    pitch = DIV_ROUND_UP(image->width, 8);
+    x0 = clamp(center_x - (int)image->width / 2, 0, METEOR_SCREEN_WIDTH - (int)image->width);
+    for (row = 0; row < image->height; row++) {
+        line = (const u8 *)image->data + row * pitch;
+        for (col = 0; col < image->width; col++) {
+            framebuffer[y + row][x0 + col] = (line[col / 8] & (0x80 >> (col % 8))) ? color : 0;
+        }
+    }
+}
+
+void meteor_emit(u8 type, s32 arg) {
+}
+
+void meteor_hist_record(enum meteor_histogram hist, u64 value) {
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+// Fill the playfield with n meteors at random places, overlaps allowed
+static void populate(int n, int fall_rate) {
+    int i;
+
+    meteor_engine_reset();
+    meteor_falling_rate = fall_rate;
+    meteor_color = meteor_colors[0];
+    n_populated = n;
+    for (i = 0; i < n; i++) {
+        meteor_spawn(rand() % (METEOR_SCREEN_WIDTH - meteor_size),
+                     rand() % METEOR_SCREEN_HEIGHT, meteor_size, meteor_size);
+    }
+    n_damage = 0;
+}
+
+// Run op in batches until min_time_ns has passed and print the result
+static void run(const char *name, int meteors, int fall_rate, void (*op)(long long i)) {
+    long long ops = 0;
+    long long batch = 1;
+    long long start;
+    long long elapsed;
+    long long i;
+
+    if (filter != NULL && strstr(name, filter) == NULL) {
+        return;
+    }
+    fprintf(stderr, "%s meteors=%d fall_rate=%d\n", name, meteors, fall_rate);
+
+    start = now_ns();
+    do {
+        for (i = 0; i < batch; i++) {
+            op(ops + i);
+        }
+        ops += batch;
+        elapsed = now_ns() - start;
+        if (batch < (1 << 20)) {
+            batch *= 2;
+        }
+    } while (elapsed < min_time_ns);
+
+    printf("%s,%d,%d,%lld,%.1f,%.0f\n", name, meteors, fall_rate, ops, (double)elapsed / ops,
+           ops * (double)NS_PER_SEC / elapsed);
+    fflush(stdout);
+}
+
+// One meteor tick. Meteors that fell off are put back at the top so the
+// count stays the same, the pending fills are dropped instead of drawn.
+static void op_move_all(long long i) {
+    meteor_move_all();
+    n_damage = 0;
+    while (n_meteors < n_populated) {
+        meteor_spawn(rand() % (METEOR_SCREEN_WIDTH - meteor_size), 0, meteor_size, meteor_size);
+    }
+}
+
+static void op_collision(long long i) {
+    sink += meteor_check_collision(i % (METEOR_SCREEN_WIDTH - METEOR_CHARACTER_SIZE));
+}
+
+static void op_spawn_scan(long long i) {
+    sink += meteor_spawn_blocked(i % (METEOR_SCREEN_WIDTH - meteor_size));
+}
+
+// A meteor falling by the fall rate, from queueing the fills to drawing them
+static void op_redraw_meteor(long long i) {
+    meteor_position_t old_position = {100, i % 200, METEOR_SIZE, METEOR_SIZE};
+    meteor_position_t new_position = old_position;
+
+    new_position.dy += meteor_falling_rate;
+    redraw_meteor(&old_position, &new_position, meteor_color);
+    damage_flush();
+}
+
+static void op_game_over(long long i) {
+    meteor_game_over();
+}
+
+static void op_imu_decode(long long i) {
+    static uint8_t buf[IMU_BURST_LEN] = {0x01, 0x20, 0xfe, 0x10, 0x40, 0x00, 0x00, 0x35,
+                                         0xff, 0xc0, 0x00, 0x12, 0x07, 0x80};
+    imu_data_t data;
+
+    buf[1] = i;
+    imu_decode_burst(buf, &data);
+    sink += (long long)data.accel_x;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [-t min_time_ms] [-f name]\n", prog);
+    printf("  -t  minimum run time of each case, default %d ms\n", DEFAULT_MIN_TIME_MS);
+    printf("  -f  only run cases whose name contains this\n");
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    int m;
+    int r;
+
+    while ((opt = getopt(argc, argv, "t:f:")) != -1) {
+        switch (opt) {
+        case 't':
+            min_time_ns = atoll(optarg) * 1000 * 1000LL;
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    srand(1);
+    meteor_text_init();
+    // Room for the largest meteor count
+    if (meteor_engine_init(METEOR_SCREEN_WIDTH, METEOR_SCREEN_HEIGHT, METEOR_MAX_CAPACITY) < 0) {
+        fprintf(stderr, "Failed to allocate the meteors\n");
+        return 1;
+    }
+    // Time full size meteors like the default game, not the shower the large capacity turns on
+    meteor_size = METEOR_SIZE;
+    meteor_shower = 0;
+    printf("name,meteors,fall_rate,ops,ns_per_op,ops_per_sec\n");
+
+    for (m = 0; m < N_METEOR_COUNTS; m++) {
+        for (r = 0; r < N_FALL_RATES; r++) {
+            populate(meteor_counts[m], fall_rates[r]);
+            run("move_all", meteor_counts[m], fall_rates[r], op_move_all);
+        }
+    }
+    for (m = 0; m < N_METEOR_COUNTS; m++) {
+        populate(meteor_counts[m], 0);
+        run("collision", meteor_counts[m], 0, op_collision);
+        run("spawn_scan", meteor_counts[m], 0, op_spawn_scan);
+    }
+    meteor_engine_reset();
+    for (r = 0; r < N_FALL_RATES; r++) {
+        meteor_falling_rate = fall_rates[r];
+        run("redraw_meteor", 0, fall_rates[r], op_redraw_meteor);
+    }
+    run("game_over", 0, 0, op_game_over);
+    run("imu_decode", 0, 0, op_imu_decode);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#include "kcompat.h"
+
+// The module draws text with a kernel console font, the host has none. This
+// is an 8x8 one in the same layout, one byte per row with the leftmost pixel
+// in the high bit. Only the characters the game shows are drawn, the rest are
+// blank.
+
+static const u8 font_data[256 * 8] = {
+    ['0' * 8] = 0x3c, 0x66, 0x6e, 0x7e, 0x76, 0x66, 0x3c, 0x00,
+    ['1' * 8] = 0x18, 0x38, 0x18, 0x18, 0x18, 0x18, 0x7e, 0x00,
+    ['2' * 8] = 0x3c, 0x66, 0x06, 0x0c, 0x18, 0x30, 0x7e, 0x00,
+    ['3' * 8] = 0x3c, 0x66, 0x06, 0x1c, 0x06, 0x66, 0x3c, 0x00,
+    ['4' * 8] = 0x0c, 0x1c, 0x3c, 0x6c, 0x7e, 0x0c, 0x0c, 0x00,
+    ['5' * 8] = 0x7e, 0x60, 0x7c, 0x06, 0x06, 0x66, 0x3c, 0x00,
+    ['6' * 8] = 0x3c, 0x60, 0x60, 0x7c, 0x66, 0x66, 0x3c, 0x00,
+    ['7' * 8] = 0x7e, 0x06, 0x0c, 0x18, 0x30, 0x30, 0x30, 0x00,
+    ['8' * 8] = 0x3c, 0x66, 0x66, 0x3c, 0x66, 0x66, 0x3c, 0x00,
+    ['9' * 8] = 0x3c, 0x66, 0x66, 0x3e, 0x06, 0x06, 0x3c, 0x00,
+    ['A' * 8] = 0x18, 0x3c, 0x66, 0x66, 0x7e, 0x66, 0x66, 0x00,
+    ['B' * 8] = 0x7c, 0x66, 0x66, 0x7c, 0x66, 0x66, 0x7c, 0x00,
+    ['C' * 8] = 0x3c, 0x66, 0x60, 0x60, 0x60, 0x66, 0x3c, 0x00,
+    ['D' * 8] = 0x78, 0x6c, 0x66, 0x66, 0x66, 0x6c, 0x78, 0x00,
+    ['E' * 8] = 0x7e, 0x60, 0x60, 0x7c, 0x60, 0x60, 0x7e, 0x00,
+    ['F' * 8] = 0x7e, 0x60, 0x60, 0x7c, 0x60, 0x60, 0x60, 0x00,
+    ['G' * 8] = 0x3c, 0x66, 0x60, 0x6e, 0x66, 0x66, 0x3e, 0x00,
+    ['H' * 8] = 0x66, 0x66, 0x66, 0x7e, 0x66, 0x66, 0x66, 0x00,
+    ['I' * 8] = 0x3c, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3c, 0x00,
+    ['J' * 8] = 0x1e, 0x0c, 0x0c, 0x0c, 0x0c, 0x6c, 0x38, 0x00,
+    ['K' * 8] = 0x66, 0x6c, 0x78, 0x70, 0x78, 0x6c, 0x66, 0x00,
+    ['L' * 8] = 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x7e, 0x00,
+    ['M' * 8] = 0xc6, 0xee, 0xfe, 0xd6, 0xc6, 0xc6, 0xc6, 0x00,
+    ['N' * 8] = 0x66, 0x76, 0x7e, 0x7e, 0x6e, 0x66, 0x66, 0x00,
+    ['O' * 8] = 0x3c, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3c, 0x00,
+    ['P' * 8] = 0x7c, 0x66, 0x66, 0x7c, 0x60, 0x60, 0x60, 0x00,
+    ['Q' * 8] = 0x3c, 0x66, 0x66, 0x66, 0x6e, 0x3c, 0x06, 0x00,
+    ['R' * 8] = 0x7c, 0x66, 0x66, 0x7c, 0x78, 0x6c, 0x66, 0x00,
+    ['S' * 8] = 0x3c, 0x66, 0x60, 0x3c, 0x06, 0x66, 0x3c, 0x00,
+    ['T' * 8] = 0x7e, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00,
+    ['U' * 8] = 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3c, 0x00,
+    ['V' * 8] = 0x66, 0x66, 0x66, 0x66, 0x66, 0x3c, 0x18, 0x00,
+    ['W' * 8] = 0xc6, 0xc6, 0xc6, 0xd6, 0xfe, 0xee, 0xc6, 0x00,
+    ['X' * 8] = 0x66, 0x66, 0x3c, 0x18, 0x3c, 0x66, 0x66, 0x00,
+    ['Y' * 8] = 0x66, 0x66, 0x66, 0x3c, 0x18, 0x18, 0x18, 0x00,
+    ['Z' * 8] = 0x7e, 0x06, 0x0c, 0x18, 0x30, 0x60, 0x7e, 0x00,
+};
+
+static const struct font_desc font_8x8 = {
+    .name = "VGA8x8",
+    .width = 8,
+    .height = 8,
+    .data = font_data,
+};
+
+const struct font_desc *get_default_font(int xres, int yres, u32 font_w, u32 font_h) {
+    return &font_8x8;
+}
@@ -0,0 +1,73 @@
+#ifndef KCOMPAT_H
+#define KCOMPAT_H
+
+// Just enough of the kernel API for the engine and the text cache in km/ to
+// build on the host
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/types.h>
+#include <linux/fb.h>
+
+typedef __u8 u8;
+typedef __u16 u16;
+typedef __s16 s16;
+typedef __u32 u32;
+typedef __s32 s32;
+typedef __u64 u64;
+typedef __s64 s64;
+
+#define S16_MAX INT16_MAX
+
+#define min(a, b) ({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a < _b ? _a : _b; })
+#define max(a, b) ({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a > _b ? _a : _b; })
+#define clamp(val, lo, hi) min(max(val, lo), hi)
+#define max_t(type, a, b) max((type)(a), (type)(b))
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+
+// Square root rounded down, only used at init so the slow way will do
+static inline unsigned long int_sqrt(unsigned long x) {
+    unsigned long r = 0;
+
+    while ((r + 1) * (r + 1) <= x) {
+        r++;
+    }
+    return r;
+}
+
+#define GFP_KERNEL 0
+#define GFP_ATOMIC 0
+#define kcalloc(n, size, flags) calloc(n, size)
+#define kzalloc(size, flags) calloc(1, size)
+#define kfree(ptr) free((void *)(ptr))
+
+// Copy src into dest and always terminate it, -E2BIG if it was cut short
+static inline long strscpy(char *dest, const char *src, size_t count) {
+    size_t len = strnlen(src, count);
+
+    if (count == 0) {
+        return -E2BIG;
+    }
+    if (len == count) {
+        memcpy(dest, src, count - 1);
+        dest[count - 1] = '\0';
+        return -E2BIG;
+    }
+    memcpy(dest, src, len + 1);
+    return len;
+}
+
+// A console font, sim/font_8x8.c has the only one on the host
+struct font_desc {
+    const char *name;
+    int width, height;
+    const void *data;
+};
+
+const struct font_desc *get_default_font(int xres, int yres, u32 font_w, u32 font_h);
+
+#endif
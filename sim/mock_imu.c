@@ -0,0 +1,97 @@
+#include "mock_imu.h"
+#include <math.h>
+#include <stdio.h>
+
+// Same scales as the real sensor at its default ranges
+#define ACCEL_COUNTS_PER_G 16384
+#define GYRO_COUNTS_PER_DPS 131
+
+// Still for a second so the gyro bias can be measured, then sway left and right
+static const mock_keyframe_t default_script[] = {
+    {0, 0},
+    {1000, 0},
+    {2000, 15000},
+    {4000, -15000},
+    {5000, 0},
+};
+
+void mock_imu_default(mock_imu_t *imu) {
+    int i;
+
+    imu->n_keyframes = sizeof(default_script) / sizeof(default_script[0]);
+    for (i = 0; i < imu->n_keyframes; i++) {
+        imu->keyframes[i] = default_script[i];
+    }
+    imu->gyro_bias = 40;
+}
+
+// One "<time_ms> <tilt_deg>" keyframe per line, '#' starts a comment line
+int mock_imu_load(mock_imu_t *imu, const char *path) {
+    char line[128];
+    unsigned time_ms;
+    double tilt_deg;
+    FILE *file;
+
+    file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    imu->n_keyframes = 0;
+    imu->gyro_bias = 40;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#' || sscanf(line, "%u %lf", &time_ms, &tilt_deg) != 2) {
+            continue;
+        }
+        if (imu->n_keyframes == MOCK_IMU_MAX_KEYFRAMES ||
+            (imu->n_keyframes == 0 && time_ms != 0) ||
+            (imu->n_keyframes > 0 && time_ms <= imu->keyframes[imu->n_keyframes - 1].time_ms)) {
+            fclose(file);
+            return -1;
+        }
+        imu->keyframes[imu->n_keyframes].time_ms = time_ms;
+        imu->keyframes[imu->n_keyframes].tilt_mdeg = (int32_t)(tilt_deg * 1000);
+        imu->n_keyframes++;
+    }
+    fclose(file);
+
+    // A script needs at least one segment
+    return imu->n_keyframes >= 2 ? 0 : -1;
+}
+
+// Scripted tilt at time_us, and how fast it is changing
+int32_t mock_imu_tilt(const mock_imu_t *imu, uint64_t time_us, int32_t *rate_mdps) {
+    const mock_keyframe_t *a;
+    const mock_keyframe_t *b;
+    uint64_t period_us = imu->keyframes[imu->n_keyframes - 1].time_ms * 1000ULL;
+    int64_t t_us = time_us % period_us;
+    int64_t length_us;
+    int i;
+
+    for (i = 1; i < imu->n_keyframes - 1; i++) {
+        if (t_us < imu->keyframes[i].time_ms * 1000LL) {
+            break;
+        }
+    }
+    a = &imu->keyframes[i - 1];
+    b = &imu->keyframes[i];
+    length_us = (b->time_ms - a->time_ms) * 1000LL;
+    t_us -= a->time_ms * 1000LL;
+
+    *rate_mdps = (int32_t)((b->tilt_mdeg - a->tilt_mdeg) * 1000000LL / length_us);
+    return a->tilt_mdeg + (int32_t)((b->tilt_mdeg - a->tilt_mdeg) * t_us / length_us);
+}
+
+// What the sensor would report at time_us, in raw counts
+void mock_imu_read(const mock_imu_t *imu, uint64_t time_us, imu_raw_t *raw) {
+    int32_t rate_mdps;
+    double tilt = mock_imu_tilt(imu, time_us, &rate_mdps) / 1000.0 * M_PI / 180.0;
+    long gyro_y = (long)rate_mdps * GYRO_COUNTS_PER_DPS / 1000 + imu->gyro_bias;
+
+    // Positive tilt means the board leans right, gravity shows up on -x
+    raw->accel_x = (int16_t)lround(-sin(tilt) * ACCEL_COUNTS_PER_G);
+    raw->accel_y = 0;
+    raw->accel_z = (int16_t)lround(cos(tilt) * ACCEL_COUNTS_PER_G);
+    raw->gyro_x = 0;
+    raw->gyro_y = (int16_t)(gyro_y > INT16_MAX ? INT16_MAX : gyro_y < INT16_MIN ? INT16_MIN : gyro_y);
+    raw->gyro_z = 0;
+}
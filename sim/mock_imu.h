@@ -0,0 +1,29 @@
+#ifndef MOCK_IMU_H
+#define MOCK_IMU_H
+
+#include <stdint.h>
+
+#include "imu_filter.h"
+
+// A tilt script stands in for the ICM-20948. Tilt is interpolated linearly
+// between keyframes and the script repeats after the last one.
+#define MOCK_IMU_MAX_KEYFRAMES 256
+
+typedef struct {
+    uint32_t time_ms;       // since the start of the script, the first keyframe is at 0
+    int32_t tilt_mdeg;
+} mock_keyframe_t;
+
+typedef struct {
+    mock_keyframe_t keyframes[MOCK_IMU_MAX_KEYFRAMES];
+    int n_keyframes;
+    int16_t gyro_bias;      // raw counts added to gyro_y, the filter calibrates it away
+} mock_imu_t;
+
+// Function declarations
+void mock_imu_default(mock_imu_t *imu);
+int mock_imu_load(mock_imu_t *imu, const char *path);
+int32_t mock_imu_tilt(const mock_imu_t *imu, uint64_t time_us, int32_t *rate_mdps);
+void mock_imu_read(const mock_imu_t *imu, uint64_t time_us, imu_raw_t *raw);
+
+#endif
@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "meteor_engine.h"
+#include "meteor_stats.h"
+#include "meteor_text.h"
+#include "meteor_game.h"
+#include "mock_imu.h"
+#include "imu_trace.h"
+
+// Headless host build of the game. The engine from km/ draws into an
+// in-memory framebuffer, the loop rules from ul/ steer from a scripted IMU.
+// Game time advances by one frame period per iteration and nothing sleeps, so
+// the whole run is CPU bound and can be profiled with perf or valgrind.
+// Replaying a trace recorded by ul/meteor -t plays the recorded games again,
+// frame for frame, with meteor ticks in simulated time.
+
+#define NS_PER_SEC (1000 * 1000 * 1000LL)
+#define DEFAULT_FRAMES 100000
+#define DEFAULT_RATE_HZ 60
+// Same gyro rate as the real IMU in FIFO mode
+#define IMU_RATE_HZ 220
+#define TICK_NS (METEOR_TICK_MS * 1000 * 1000LL)
+
+// 8-bit palette indices, like the board's framebuffer
+static u8 framebuffer[METEOR_SCREEN_HEIGHT][METEOR_SCREEN_WIDTH];
+
+u64 meteor_counters[METEOR_N_COUNTERS];
+static u64 histograms[METEOR_N_HISTOGRAMS][METEOR_HIST_BUCKETS];
+static u64 events[METEOR_EVENT_COLLISION + 1];
+
+static const char *const counter_names[METEOR_N_COUNTERS] = {
+    [METEOR_STAT_TICKS] = "ticks",
+    [METEOR_STAT_FILLS] = "fills",
+    [METEOR_STAT_PIXELS] = "pixels",
+    [METEOR_STAT_SPAWNS] = "spawns",
+    [METEOR_STAT_SPAWN_REJECTS] = "spawn_rejects",
+    [METEOR_STAT_DESPAWNS] = "despawns",
+    [METEOR_STAT_COLLISIONS] = "collisions",
+    [METEOR_STAT_WRITES] = "writes",
+    [METEOR_STAT_WRITE_BYTES] = "write_bytes",
+    [METEOR_STAT_EVENTS_DROPPED] = "events_dropped",
+};
+
+// Default VGA palette, for dumping the framebuffer
+static const u8 palette[16][3] = {
+    {0x00, 0x00, 0x00}, {0x00, 0x00, 0xAA}, {0x00, 0xAA, 0x00}, {0x00, 0xAA, 0xAA},
+    {0xAA, 0x00, 0x00}, {0xAA, 0x00, 0xAA}, {0xAA, 0x55, 0x00}, {0xAA, 0xAA, 0xAA},
+    {0x55, 0x55, 0x55}, {0x55, 0x55, 0xFF}, {0x55, 0xFF, 0x55}, {0x55, 0xFF, 0xFF},
+    {0xFF, 0x55, 0x55}, {0xFF, 0x55, 0xFF}, {0xFF, 0xFF, 0x55}, {0xFF, 0xFF, 0xFF},
+};
+
+static struct meteor_cmd cmds[METEOR_MAX_BATCH];
+static int n_cmds = 0;
+
+void meteor_fill(int x, int y, int w, int h, u32 color) {
+    int x1 = min(x + w, METEOR_SCREEN_WIDTH);
+    int y1 = min(y + h, METEOR_SCREEN_HEIGHT);
+
+    x = max(x, 0);
+    y = max(y, 0);
+    meteor_stat_inc(METEOR_STAT_FILLS);
+    if (x >= x1 || y >= y1) {
+        return;
+    }
+    meteor_stat_add(METEOR_STAT_PIXELS, (x1 - x) * (y1 - y));
+    for (; y < y1; y++) {
+        memset(&framebuffer[y][x], color, x1 - x);
+    }
+}
+
+// Draw text centered on center_x from the module's text cache, with the same
+// clipping and black background as its imageblit
+void meteor_text(int center_x, int y, int height, u32 color, const char *text) {
+    const struct fb_image *image = meteor_text_render(text, height);
+    const u8 *line;
+    int pitch;
+    int x0;
+    int row;
+    int col;
+
+    if (!image || image->width > METEOR_SCREEN_WIDTH || y < 0 ||
+        y + image->height > METEOR_SCREEN_HEIGHT) {
+        return;
+    }
+    pitch = DIV_ROUND_UP(image->width, 8);
+    x0 = clamp(center_x - (int)image->width / 2, 0, METEOR_SCREEN_WIDTH - (int)image->width);
+    for (row = 0; row < image->height; row++) {
+        line = (const u8 *)image->data + row * pitch;
+        for (col = 0; col < image->width; col++) {
+            framebuffer[y + row][x0 + col] = (line[col / 8] & (0x80 >> (col % 8))) ? color : 0;
+        }
+    }
+}
+
+void meteor_emit(u8 type, s32 arg) {
+    events[type]++;
+}
+
+// Bucket i counts values in [2^(i-1), 2^i), like the module's debugfs histograms
+void meteor_hist_record(enum meteor_histogram hist, u64 value) {
+    int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+    histograms[hist][min(bucket, METEOR_HIST_BUCKETS - 1)]++;
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void queue_cmd(u8 opcode, s32 arg) {
+    if (n_cmds == METEOR_MAX_BATCH) {
+        return;
+    }
+    cmds[n_cmds].version = METEOR_DASH_VERSION;
+    cmds[n_cmds].opcode = opcode;
+    cmds[n_cmds].reserved = 0;
+    cmds[n_cmds].arg = arg;
+    n_cmds++;
+}
+
+// The commands the last game step queued, applied by the next render pass
+static void queue_game_cmds(game_t *game) {
+    int i;
+
+    for (i = 0; i < game->n_cmds; i++) {
+        queue_cmd(game->cmds[i].opcode, game->cmds[i].arg);
+    }
+    game->n_cmds = 0;
+}
+
+// One render pass the way the module runs it, either a meteor tick or the
+// commands of one frame. Returns true if the game ended.
+static bool render_pass(bool tick) {
+    struct meteor_batch batch;
+    long long start = now_ns();
+    bool over;
+    int i;
+
+    meteor_begin_batch(&batch, tick);
+    for (i = 0; i < n_cmds; i++) {
+        meteor_apply_cmd(&cmds[i], &batch);
+    }
+    n_cmds = 0;
+    over = meteor_end_batch(&batch, tick);
+
+    if (tick) {
+        meteor_emit(METEOR_EVENT_TICK, n_meteors);
+        meteor_stat_inc(METEOR_STAT_TICKS);
+        meteor_hist_record(METEOR_HIST_TICK_NS, now_ns() - start);
+    }
+    return over;
+}
+
+static int dump_framebuffer(const char *path) {
+    FILE *file;
+    int x;
+    int y;
+
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", METEOR_SCREEN_WIDTH, METEOR_SCREEN_HEIGHT);
+    for (y = 0; y < METEOR_SCREEN_HEIGHT; y++) {
+        for (x = 0; x < METEOR_SCREEN_WIDTH; x++) {
+            fwrite(palette[framebuffer[y][x] & 0x0F], 3, 1, file);
+        }
+    }
+    return fclose(file);
+}
+
+static void report(long long frames, int games, long long total_score, int best_score,
+                   long long elapsed_ns) {
+    int i;
+
+    printf("%lld frames, %d games in %.3f s, %.0f frames/s, %.0f ns/frame\n", frames, games,
+           (double)elapsed_ns / NS_PER_SEC, frames * (double)NS_PER_SEC / elapsed_ns,
+           (double)elapsed_ns / frames);
+    printf("score: mean %.1f, best %d\n", games ? (double)total_score / games : 0.0, best_score);
+    printf("events: %llu tick, %llu spawn, %llu despawn, %llu collision\n",
+           (unsigned long long)events[METEOR_EVENT_TICK],
+           (unsigned long long)events[METEOR_EVENT_SPAWN],
+           (unsigned long long)events[METEOR_EVENT_DESPAWN],
+           (unsigned long long)events[METEOR_EVENT_COLLISION]);
+    for (i = 0; i < METEOR_N_COUNTERS; i++) {
+        if (meteor_counters[i] != 0) {
+            printf("%s: %llu\n", counter_names[i], (unsigned long long)meteor_counters[i]);
+        }
+    }
+    printf("tick_ns:\n");
+    for (i = 0; i < METEOR_HIST_BUCKETS; i++) {
+        if (histograms[METEOR_HIST_TICK_NS][i] != 0) {
+            printf("  < %llu: %llu\n", 1ULL << i,
+                   (unsigned long long)histograms[METEOR_HIST_TICK_NS][i]);
+        }
+    }
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [-n frames] [-r rate_hz] [-d difficulty] [-s seed] [-c capacity] [-i tilt_script]\n"
+           "       %*s [-o frame.ppm]\n",
+           prog, (int)strlen(prog), "");
+    printf("       %s [-n frames] [-c capacity] [-o frame.ppm] -t trace\n", prog);
+    printf("  -n  frames to simulate, games restart until they are used up (default %d)\n",
+           DEFAULT_FRAMES);
+    printf("  -r  game loop rate in Hz, sets the game time per frame (default %d)\n", DEFAULT_RATE_HZ);
+    printf("  -d  starting difficulty, 1 - %d (default 1)\n", MAX_DIFFICULTY);
+    printf("  -s  random seed, runs with the same seed are identical (default 1)\n");
+    printf("  -c  meteors on screen at once, 1 - %d (default %d)\n", METEOR_MAX_CAPACITY,
+           METEOR_DEFAULT_CAPACITY);
+    printf("  -i  tilt script, one \"<time_ms> <tilt_deg>\" keyframe per line\n");
+    printf("  -t  replay a trace recorded by meteor -t, its rate, seed and games are used\n");
+    printf("  -o  write the last frame as a PPM image\n");
+}
+
+int main(int argc, char **argv) {
+    long long n_frames = DEFAULT_FRAMES;
+    int rate_hz = DEFAULT_RATE_HZ;
+    int start_difficulty = 1;
+    unsigned seed = 1;
+    int capacity = METEOR_DEFAULT_CAPACITY;
+    const char *frame_path = NULL;
+    bool replaying = false;
+    imu_trace_t trace;
+    imu_trace_header_t trace_header;
+    mock_imu_t imu;
+    imu_filter_t filter;
+    imu_raw_t raw;
+    long long imu_period_ns = NS_PER_SEC / IMU_RATE_HZ;
+    long long period_ns;
+    long long sim_ns = 0;       // simulated time since the start of the run
+    long long imu_ns = 0;       // time of the last IMU sample
+    long long script_ns = 0;    // when the tilt script started over
+    long long next_tick_ns;
+    long long frame_ns;
+    long long frames = 0;
+    long long total_score = 0;
+    long long start;
+    int best_score = 0;
+    int games = 0;
+    game_t game;
+    int periods;
+    bool over;
+    int opt;
+
+    mock_imu_default(&imu);
+    while ((opt = getopt(argc, argv, "n:r:d:s:c:i:t:o:")) != -1) {
+        switch (opt) {
+        case 'n':
+            n_frames = atoll(optarg);
+            break;
+        case 'r':
+            rate_hz = atoi(optarg);
+            break;
+        case 'd':
+            start_difficulty = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            capacity = atoi(optarg);
+            break;
+        case 'i':
+            if (mock_imu_load(&imu, optarg) < 0) {
+                fprintf(stderr, "Invalid tilt script %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 't':
+            if (imu_trace_open(&trace, optarg, &trace_header) < 0) {
+                perror("Failed to open IMU trace");
+                return 1;
+            }
+            replaying = true;
+            break;
+        case 'o':
+            frame_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (n_frames < 1 || rate_hz < 1 || rate_hz > 1000 ||
+        capacity < 1 || capacity > METEOR_MAX_CAPACITY ||
+        start_difficulty < 1 || start_difficulty > MAX_DIFFICULTY) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (replaying) {
+        rate_hz = trace_header.rate_hz;
+        seed = trace_header.seed;
+        imu_filter_init(&filter);
+    }
+    period_ns = NS_PER_SEC / rate_hz;
+    srand(seed);
+
+    meteor_text_init();
+    if (meteor_engine_init(METEOR_SCREEN_WIDTH, METEOR_SCREEN_HEIGHT, capacity) < 0) {
+        fprintf(stderr, "Failed to allocate room for %d meteors\n", capacity);
+        return 1;
+    }
+    start = now_ns();
+    while (frames < n_frames) {
+        // New game, like reopening the device
+        meteor_engine_reset();
+        meteor_new_game();
+
+        if (replaying) {
+            // The trace carries its own calibration samples
+            difficulty_lvl = imu_trace_replay_game(&trace, &filter);
+            if (difficulty_lvl <= 0) {
+                break;
+            }
+        } else {
+            // Measure the gyro bias, the script has to start still for this
+            difficulty_lvl = start_difficulty;
+            imu_filter_init(&filter);
+            script_ns = imu_ns;
+            while (!imu_filter_calibrated(&filter)) {
+                imu_ns += imu_period_ns;
+                mock_imu_read(&imu, (imu_ns - script_ns) / 1000, &raw);
+                imu_filter_update(&filter, &raw, imu_period_ns / 1000);
+            }
+            sim_ns = imu_ns;
+        }
+        next_tick_ns = sim_ns + TICK_NS;
+
+        // The same game steps as ul/meteor, the sim only supplies time and the IMU
+        game_start(&game, false);
+        queue_game_cmds(&game);
+        over = false;
+        while (!over && frames < n_frames) {
+            // A replayed frame lasts as long as it did when recorded
+            frame_ns = period_ns;
+            if (replaying) {
+                periods = imu_trace_replay_frame(&trace, &filter);
+                if (periods <= 0) {
+                    break;
+                }
+                frame_ns = periods * period_ns;
+            }
+            sim_ns += frame_ns;
+            frames++;
+
+            // Meteor ticks that came due during this frame
+            while (!over && next_tick_ns <= sim_ns) {
+                over = render_pass(true);
+                next_tick_ns += TICK_NS;
+            }
+            if (over) {
+                break;
+            }
+
+            game_frame_score(&game, frame_ns);
+
+            // Everything the IMU would have queued since the last frame
+            if (replaying) {
+                imu_trace_replay_samples(&trace, &filter);
+            }
+            while (!replaying && imu_ns + imu_period_ns <= sim_ns) {
+                imu_ns += imu_period_ns;
+                mock_imu_read(&imu, (imu_ns - script_ns) / 1000, &raw);
+                imu_filter_update(&filter, &raw, imu_period_ns / 1000);
+            }
+            game_frame_move(&game, filter.tilt_mdeg, frame_ns);
+            queue_game_cmds(&game);
+            over = render_pass(false);
+        }
+
+        // A game cut short by the frame budget still counts
+        games++;
+        total_score += game.score;
+        best_score = max(best_score, game.score);
+        n_cmds = 0;
+    }
+    report(frames, games, total_score, best_score, now_ns() - start);
+
+    if (frame_path != NULL && dump_framebuffer(frame_path) != 0) {
+        perror("Failed to write frame");
+        return 1;
+    }
+    return 0;
+}
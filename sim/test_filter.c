@@ -0,0 +1,100 @@
+#include <stdio.h>
+
+#include "imu_filter.h"
+
+// Checks of the fixed-point tilt filter at the edges of its input ranges.
+// Built with -fsanitize=undefined by `make check`, so an overflow fails the
+// run even when the result happens to look plausible.
+
+static int failures;
+
+#define CHECK(cond, ...)                                        \
+    do {                                                        \
+        if (!(cond)) {                                          \
+            printf("%s:%d: ", __FILE__, __LINE__);              \
+            printf(__VA_ARGS__);                                \
+            printf("\n");                                       \
+            failures++;                                         \
+        }                                                       \
+    } while (0)
+
+// Level board, calibrated with no gyro bias
+static void start_level(imu_filter_t *filter, imu_raw_t *raw) {
+    imu_raw_t level = {0, 0, 16384, 0, 0, 0};
+
+    *raw = level;
+    imu_filter_init(filter);
+    while (!imu_filter_calibrated(filter)) {
+        imu_filter_update(filter, raw, 1000);
+    }
+}
+
+// A saturated gyro over a kernel tick turns 25 degrees, less the accel pull
+static void test_saturated_gyro(void) {
+    imu_filter_t filter;
+    imu_raw_t raw;
+    int32_t last;
+    int i;
+
+    start_level(&filter, &raw);
+    raw.gyro_y = 0x7FFF;
+    imu_filter_update(&filter, &raw, 100000);
+    CHECK(filter.tilt_mdeg > 20000 && filter.tilt_mdeg < 21000,
+          "saturated gyro over 100 ms gave %d mdeg", filter.tilt_mdeg);
+
+    // Keeps turning the same way until the accel pull balances it
+    for (i = 0; i < 20; i++) {
+        last = filter.tilt_mdeg;
+        imu_filter_update(&filter, &raw, 100000);
+        CHECK(filter.tilt_mdeg >= last, "tilt went back from %d to %d mdeg", last,
+              filter.tilt_mdeg);
+    }
+
+    start_level(&filter, &raw);
+    raw.gyro_y = -0x8000;
+    imu_filter_update(&filter, &raw, 100000);
+    CHECK(filter.tilt_mdeg < -20000 && filter.tilt_mdeg > -21000,
+          "negative saturated gyro over 100 ms gave %d mdeg", filter.tilt_mdeg);
+}
+
+// After a one second gap the accel pulls two thirds of the way back
+static void test_long_gap(void) {
+    imu_filter_t filter;
+    imu_raw_t raw;
+
+    start_level(&filter, &raw);
+    filter.tilt_mdeg = 170000;
+    imu_filter_update(&filter, &raw, IMU_FILTER_MAX_DT_US);
+    CHECK(filter.tilt_mdeg > 56000 && filter.tilt_mdeg < 57500,
+          "one second gap from 170 degrees gave %d mdeg", filter.tilt_mdeg);
+
+    start_level(&filter, &raw);
+    filter.tilt_mdeg = -170000;
+    imu_filter_update(&filter, &raw, 10 * IMU_FILTER_MAX_DT_US);
+    CHECK(filter.tilt_mdeg < -56000 && filter.tilt_mdeg > -57500,
+          "ten second gap from -170 degrees gave %d mdeg", filter.tilt_mdeg);
+}
+
+// Every accel axis saturated, the squares sum to 2^31
+static void test_saturated_accel(void) {
+    imu_filter_t filter;
+    imu_raw_t raw = {-0x8000, -0x8000, -0x8000, 0, 0, 0};
+
+    imu_filter_init(&filter);
+    imu_filter_update(&filter, &raw, 0);
+    CHECK(filter.tilt_mdeg > 35000 && filter.tilt_mdeg < 35500,
+          "saturated accel gave %d mdeg", filter.tilt_mdeg);
+}
+
+int main(void) {
+    test_saturated_gyro();
+    test_long_gap();
+    test_saturated_accel();
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("imu_filter: all checks passed\n");
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "imu_driver.h"
+#include <errno.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,7 +16,23 @@
 #define WHO_AM_I_REG 0x00
 #define WHO_AM_I_EXPECTED 0xEA
 #define ACCEL_XOUT_H 0x2D
-#define GYRO_XOUT_H 0x2D
+#define GYRO_XOUT_H 0x33
+#define TEMP_OUT_H 0x39
+
+// Bank 0 FIFO registers
+#define USER_CTRL 0x03
+#define FIFO_EN_2 0x67
+#define FIFO_RST 0x68
+#define FIFO_MODE 0x69
+#define FIFO_COUNTH 0x70
+#define FIFO_R_W 0x72
+#define USER_CTRL_FIFO_EN 0x40
+#define FIFO_EN_2_GYRO 0x0E
+
+// Bank 2 output data rate and filter registers
+#define GYRO_SMPLRT_DIV 0x00
+#define GYRO_CONFIG_1 0x01
+#define FCHOICE_DLPF 0x01
 
 int imu_init(int file_handle) {
     // Set the I2C slave address for the next transfers
@@ -58,74 +75,171 @@ int imu_init(int file_handle) {
     return 0;
 }
 
-imu_data_t imu_read(int file_handle) {
-    imu_data_t data = {0};
+static int imu_write_reg(int file_handle, uint8_t reg, uint8_t value) {
+    uint8_t cmd[2] = {reg, value};
+    return write(file_handle, cmd, 2) == 2 ? 0 : -1;
+}
 
-    // Acceleration
-    uint8_t reg_addr_accel = ACCEL_XOUT_H;
-    uint8_t accel_data_buffer[6] = {0};
+// Register address write followed by a read of len bytes, in one transaction
+static int imu_read_regs(int file_handle, uint8_t reg, uint8_t *buf, uint16_t len) {
     struct i2c_msg msgs[2];
     struct i2c_rdwr_ioctl_data msgset;
 
     msgs[0].addr = DEVICE_ADDRESS;
     msgs[0].flags = 0;
     msgs[0].len = 1;
-    msgs[0].buf = &reg_addr_accel;
+    msgs[0].buf = &reg;
 
     msgs[1].addr = DEVICE_ADDRESS;
     msgs[1].flags = I2C_M_RD;
-    msgs[1].len = 6;
-    msgs[1].buf = &accel_data_buffer;
+    msgs[1].len = len;
+    msgs[1].buf = buf;
 
     msgset.msgs = msgs;
     msgset.nmsgs = 2;
 
-    if (ioctl(file_handle, I2C_RDWR, &msgset) < 0) {
-        perror("Failed to read acceleration data");
-        close(file_handle);
-        exit(1);
-    }
+    return ioctl(file_handle, I2C_RDWR, &msgset) < 0 ? -1 : 0;
+}
+
+// Convert an accel sample laid out as in the output registers. Registers are
+// big-endian.
+static void imu_decode_accel(const uint8_t *accel, imu_data_t *data) {
+    int16_t accel_x = (int16_t)(accel[0] << 8 | accel[1]);
+    int16_t accel_y = (int16_t)(accel[2] << 8 | accel[3]);
+    int16_t accel_z = (int16_t)(accel[4] << 8 | accel[5]);
+
+    data->accel_x = (float)accel_x / ACCEL_SCALE_FACTOR;
+    data->accel_y = (float)accel_y / ACCEL_SCALE_FACTOR;
+    data->accel_z = (float)accel_z / ACCEL_SCALE_FACTOR;
+}
 
-    int16_t accel_x = (int16_t)(accel_data_buffer[0] << 8 | accel_data_buffer[1]);
-    int16_t accel_y = (int16_t)(accel_data_buffer[2] << 8 | accel_data_buffer[3]);
-    int16_t accel_z = (int16_t)(accel_data_buffer[4] << 8 | accel_data_buffer[5]);
+// Same for a gyro sample, which is also the FIFO record layout
+static void imu_decode_gyro(const uint8_t *gyro, imu_data_t *data) {
+    int16_t gyro_x = (int16_t)(gyro[0] << 8 | gyro[1]);
+    int16_t gyro_y = (int16_t)(gyro[2] << 8 | gyro[3]);
+    int16_t gyro_z = (int16_t)(gyro[4] << 8 | gyro[5]);
 
-    data.accel_x = (float)accel_x / ACCEL_SCALE_FACTOR;
-    data.accel_y = (float)accel_y / ACCEL_SCALE_FACTOR;
-    data.accel_z = (float)accel_z / ACCEL_SCALE_FACTOR;
+    data->gyro_x = (float)gyro_x / GYRO_SCALE_FACTOR;
+    data->gyro_y = (float)gyro_y / GYRO_SCALE_FACTOR;
+    data->gyro_z = (float)gyro_z / GYRO_SCALE_FACTOR;
+}
 
-    // Gyroscope
-    uint8_t reg_addr_gyro = GYRO_XOUT_H;
-    uint8_t gyro_data_buffer[6] = {0};
-    struct i2c_msg msgs_gyro[2];
-    struct i2c_rdwr_ioctl_data msgset_gyro;
+// Convert a burst starting at ACCEL_XOUT_H
+void imu_decode_burst(const uint8_t *buf, imu_data_t *data) {
+    const uint8_t *temp = buf + (TEMP_OUT_H - ACCEL_XOUT_H);
 
-    msgs_gyro[0].addr = DEVICE_ADDRESS;
-    msgs_gyro[0].flags = 0;
-    msgs_gyro[0].len = 1;
-    msgs_gyro[0].buf = &reg_addr_gyro;
+    imu_decode_accel(buf, data);
+    imu_decode_gyro(buf + (GYRO_XOUT_H - ACCEL_XOUT_H), data);
 
-    msgs_gyro[1].addr = DEVICE_ADDRESS;
-    msgs_gyro[1].flags = I2C_M_RD;
-    msgs_gyro[1].len = 6;
-    msgs_gyro[1].buf = &gyro_data_buffer;
+    int16_t temp_raw = (int16_t)(temp[0] << 8 | temp[1]);
+    data->temp_c = (float)temp_raw / TEMP_SCALE_FACTOR + TEMP_OFFSET_C;
+}
 
-    msgset_gyro.msgs = msgs_gyro;
-    msgset_gyro.nmsgs = 2;
+// Read accel, gyro and temperature in one combined transaction. The output
+// registers are contiguous, so a single address write and a 14-byte read
+// replace a round trip per sensor. Returns 0 on success, -1 on failure.
+int imu_read_into(int file_handle, imu_data_t *data) {
+    uint8_t data_buffer[IMU_BURST_LEN] = {0};
 
-    if (ioctl(file_handle, I2C_RDWR, &msgset_gyro) < 0) {
-        perror("Failed to read gyroscope data");
+    if (imu_read_regs(file_handle, ACCEL_XOUT_H, data_buffer, IMU_BURST_LEN) < 0) {
+        return -1;
+    }
+
+    imu_decode_burst(data_buffer, data);
+    return 0;
+}
+
+imu_data_t imu_read(int file_handle) {
+    imu_data_t data = {0};
+
+    if (imu_read_into(file_handle, &data) < 0) {
+        perror("Failed to read IMU data");
         close(file_handle);
         exit(1);
     }
 
-    int16_t gyro_x = (int16_t)(gyro_data_buffer[0] << 8 | gyro_data_buffer[1]);
-    int16_t gyro_y = (int16_t)(gyro_data_buffer[2] << 8 | gyro_data_buffer[3]);
-    int16_t gyro_z = (int16_t)(gyro_data_buffer[4] << 8 | gyro_data_buffer[5]);
+    return data;
+}
 
-    data.gyro_x = (float)gyro_x / GYRO_SCALE_FACTOR;
-    data.gyro_y = (float)gyro_y / GYRO_SCALE_FACTOR;
-    data.gyro_z = (float)gyro_z / GYRO_SCALE_FACTOR;
+// Initialize the chip and let it queue every gyro sample in its FIFO. The
+// gyro output data rate is IMU_GYRO_ODR_BASE_HZ / (1 + sample_rate_div) Hz.
+int imu_init_fifo(int file_handle, int sample_rate_div) {
+    if (sample_rate_div < 0 || sample_rate_div > IMU_FIFO_MAX_RATE_DIV) {
+        errno = EINVAL;
+        return 1;
+    }
+    if (imu_init(file_handle) != 0) {
+        return 1;
+    }
 
-    return data;
+    // The divider only applies with the low pass filter enabled
+    if (imu_write_reg(file_handle, REG_BANK_SEL, 0x20) < 0 ||
+        imu_write_reg(file_handle, GYRO_CONFIG_1, FCHOICE_DLPF) < 0 ||
+        imu_write_reg(file_handle, GYRO_SMPLRT_DIV, sample_rate_div) < 0) {
+        perror("Failed to set output data rate");
+        return 1;
+    }
+
+    // Back to bank 0, stream mode, empty FIFO, then start queueing
+    if (imu_write_reg(file_handle, REG_BANK_SEL, 0x00) < 0 ||
+        imu_write_reg(file_handle, FIFO_MODE, 0x00) < 0 ||
+        imu_write_reg(file_handle, FIFO_RST, 0x1F) < 0 ||
+        imu_write_reg(file_handle, FIFO_RST, 0x00) < 0 ||
+        imu_write_reg(file_handle, FIFO_EN_2, FIFO_EN_2_GYRO) < 0 ||
+        imu_write_reg(file_handle, USER_CTRL, USER_CTRL_FIFO_EN) < 0) {
+        perror("Failed to enable FIFO");
+        return 1;
+    }
+
+    return 0;
+}
+
+// Drain up to max_samples whole gyro records from the FIFO into samples,
+// oldest first, each with the current accel reading. One transfer reads the
+// count, and only when there is a record one more reads the accel and one the
+// records. Returns the number of samples read or -1 on failure.
+int imu_read_batch(int file_handle, imu_data_t *samples, int max_samples) {
+    uint8_t count_buffer[2];
+    uint8_t accel_buffer[6];
+    uint8_t fifo_buffer[IMU_FIFO_SIZE];
+    imu_data_t accel;
+    int count;
+    int n_samples;
+    int i;
+
+    if (imu_read_regs(file_handle, FIFO_COUNTH, count_buffer, 2) < 0) {
+        return -1;
+    }
+    count = (count_buffer[0] & 0x1F) << 8 | count_buffer[1];
+
+    // A full FIFO has dropped samples and may hold a partial record, start over
+    if (count >= IMU_FIFO_SIZE) {
+        if (imu_write_reg(file_handle, FIFO_RST, 0x1F) < 0 ||
+            imu_write_reg(file_handle, FIFO_RST, 0x00) < 0) {
+            return -1;
+        }
+        return 0;
+    }
+
+    n_samples = count / IMU_FIFO_SAMPLE_LEN;
+    if (n_samples > max_samples) {
+        n_samples = max_samples;
+    }
+    if (n_samples == 0) {
+        return 0;
+    }
+
+    // FIFO_R_W does not auto-increment, every byte read pops the FIFO
+    if (imu_read_regs(file_handle, ACCEL_XOUT_H, accel_buffer, sizeof(accel_buffer)) < 0 ||
+        imu_read_regs(file_handle, FIFO_R_W, fifo_buffer, n_samples * IMU_FIFO_SAMPLE_LEN) < 0) {
+        return -1;
+    }
+    imu_decode_accel(accel_buffer, &accel);
+
+    for (i = 0; i < n_samples; i++) {
+        samples[i] = accel;
+        imu_decode_gyro(fifo_buffer + i * IMU_FIFO_SAMPLE_LEN, &samples[i]);
+        samples[i].temp_c = 0.0f;
+    }
+    return n_samples;
 }
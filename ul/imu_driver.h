@@ -12,14 +12,35 @@ typedef struct {
     float gyro_x;
     float gyro_y;
     float gyro_z;
+    float temp_c;
 } imu_data_t;
 
+// Bytes in one burst: accel, gyro and temperature output registers
+#define IMU_BURST_LEN 14
+
+// Only the gyro is queued in the FIFO, the accel is read once per batch. The
+// tilt filter integrates every gyro sample and only pulls slowly towards the
+// accel, so that is all the accel it needs.
+#define IMU_FIFO_SAMPLE_LEN 6
+#define IMU_FIFO_SIZE 512
+#define IMU_FIFO_MAX_SAMPLES (IMU_FIFO_SIZE / IMU_FIFO_SAMPLE_LEN)
+
+// In FIFO mode the gyro runs at IMU_GYRO_ODR_BASE_HZ / (1 + sample_rate_div)
+#define IMU_GYRO_ODR_BASE_HZ 1100
+#define IMU_FIFO_MAX_RATE_DIV 255
+
 // Function declarations
 int imu_init(int file_handle);
 imu_data_t imu_read(int file_handle);
+int imu_read_into(int file_handle, imu_data_t *data);
+void imu_decode_burst(const uint8_t *buf, imu_data_t *data);
+int imu_init_fifo(int file_handle, int sample_rate_div);
+int imu_read_batch(int file_handle, imu_data_t *samples, int max_samples);
 
 // Constants
 #define ACCEL_SCALE_FACTOR 16384.0f
 #define GYRO_SCALE_FACTOR 131.0f
+#define TEMP_SCALE_FACTOR 333.87f
+#define TEMP_OFFSET_C 21.0f
 
 #endif
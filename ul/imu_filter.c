@@ -0,0 +1,132 @@
+#include "imu_filter.h"
+
+// Gyro counts per degree per second at the default +-250 dps range
+#define GYRO_COUNTS_PER_DPS 131
+
+// Longest step the rate is integrated over. A saturated rate of 0x7FFF times
+// this, plus a remainder under 131000, stays below 2^31.
+#define RATE_CHUNK_US 0xFFF0
+
+static uint32_t isqrt(uint32_t value) {
+    uint32_t root = 0;
+    uint32_t bit = 1u << 30;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+// atan of a Q15 ratio in [0, 1], in millidegrees. Polynomial approximation,
+// within 0.1 degree of the real thing.
+static int32_t atan_q15_mdeg(uint32_t z) {
+    uint32_t linear = (45000u * z) >> 15;
+    uint32_t curve = (z * (32768u - z)) >> 15;
+    return linear + ((curve * (14020u + ((3799u * z) >> 15))) >> 15);
+}
+
+int32_t imu_atan2_mdeg(int32_t y, int32_t x) {
+    uint32_t abs_y = y < 0 ? -y : y;
+    uint32_t abs_x = x < 0 ? -x : x;
+    int32_t angle;
+
+    if (abs_x == 0 && abs_y == 0) {
+        return 0;
+    }
+
+    // Keep the ratio in [0, 1] where the approximation holds
+    if (abs_x >= abs_y) {
+        angle = atan_q15_mdeg((abs_y << 15) / abs_x);
+    } else {
+        angle = 90000 - atan_q15_mdeg((abs_x << 15) / abs_y);
+    }
+
+    if (x < 0) {
+        angle = 180000 - angle;
+    }
+    return y < 0 ? -angle : angle;
+}
+
+// Pitch from the direction of gravity alone, noisy but free of drift
+static int32_t accel_tilt_mdeg(const imu_raw_t *raw) {
+    int32_t y = raw->accel_y;
+    int32_t z = raw->accel_z;
+    // Two saturated axes sum to 2^31, which only fits unsigned
+    return imu_atan2_mdeg(-raw->accel_x, isqrt((uint32_t)(y * y) + (uint32_t)(z * z)));
+}
+
+void imu_filter_init(imu_filter_t *filter) {
+    filter->tilt_mdeg = 0;
+    filter->gyro_bias = 0;
+    filter->bias_sum = 0;
+    filter->rate_remainder = 0;
+    filter->n_calibration = 0;
+}
+
+// Skip calibration with a gyro bias measured earlier and start the estimate
+// from the accelerometer in raw
+void imu_filter_init_calibrated(imu_filter_t *filter, int32_t gyro_bias, const imu_raw_t *raw) {
+    imu_filter_init(filter);
+    filter->gyro_bias = gyro_bias;
+    filter->n_calibration = IMU_FILTER_CALIBRATION_SAMPLES;
+    filter->tilt_mdeg = accel_tilt_mdeg(raw);
+}
+
+bool imu_filter_calibrated(const imu_filter_t *filter) {
+    return filter->n_calibration >= IMU_FILTER_CALIBRATION_SAMPLES;
+}
+
+// Feed one sample taken dt_us after the previous one, returns the new tilt.
+// The first IMU_FILTER_CALIBRATION_SAMPLES samples only measure the gyro bias
+// and start the estimate from the accelerometer.
+int32_t imu_filter_update(imu_filter_t *filter, const imu_raw_t *raw, uint32_t dt_us) {
+    int32_t rate;
+    int32_t delta;
+    int32_t gain;
+    uint32_t step;
+    uint32_t chunk;
+
+    if (!imu_filter_calibrated(filter)) {
+        filter->bias_sum += raw->gyro_y;
+        filter->n_calibration++;
+        filter->gyro_bias = filter->bias_sum / filter->n_calibration;
+        filter->tilt_mdeg = accel_tilt_mdeg(raw);
+        return filter->tilt_mdeg;
+    }
+
+    // A longer gap means the samples stopped, keeps the gain below 1
+    if (dt_us > IMU_FILTER_MAX_DT_US) {
+        dt_us = IMU_FILTER_MAX_DT_US;
+    }
+    rate = raw->gyro_y - filter->gyro_bias;
+    if (rate > 0x7FFF) {
+        rate = 0x7FFF;
+    } else if (rate < -0x7FFF) {
+        rate = -0x7FFF;
+    }
+
+    // Integrate the rate, counts * us / (131 counts/dps * 1000) = mdeg, in
+    // steps short enough that the product fits
+    for (step = dt_us; step > 0; step -= chunk) {
+        chunk = step > RATE_CHUNK_US ? RATE_CHUNK_US : step;
+        delta = rate * (int32_t)chunk + filter->rate_remainder;
+        filter->rate_remainder = delta % (GYRO_COUNTS_PER_DPS * 1000);
+        filter->tilt_mdeg += delta / (GYRO_COUNTS_PER_DPS * 1000);
+    }
+
+    // Pull towards the accelerometer with gain dt / (tau + dt), in Q15 with
+    // both terms in units of 32 us. A long gap takes the gain past 2^14, so
+    // the correction is multiplied in 64 bits, a shift needs no libgcc helper.
+    gain = ((dt_us >> 5) << 15) / ((IMU_FILTER_TAU_US + dt_us) >> 5);
+    filter->tilt_mdeg += ((int64_t)(accel_tilt_mdeg(raw) - filter->tilt_mdeg) * gain) >> 15;
+    return filter->tilt_mdeg;
+}
@@ -0,0 +1,48 @@
+#ifndef IMU_FILTER_H
+#define IMU_FILTER_H
+
+// Tilt estimation in fixed-point integer math, shared with the kernel module
+// and offline tools, so it has no dependencies besides integer types.
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+// Samples averaged for the gyro bias, the device must be still meanwhile
+#define IMU_FILTER_CALIBRATION_SAMPLES 128
+
+// Time constant of the complementary filter. Below it the gyro is trusted,
+// above it the accelerometer pulls the estimate back.
+#define IMU_FILTER_TAU_US 500000
+
+// Longest gap between samples the filter accounts for
+#define IMU_FILTER_MAX_DT_US 1000000
+
+// Sensor readings in raw counts, as they come out of the registers
+typedef struct {
+    int16_t accel_x;
+    int16_t accel_y;
+    int16_t accel_z;
+    int16_t gyro_x;
+    int16_t gyro_y;
+    int16_t gyro_z;
+} imu_raw_t;
+
+typedef struct {
+    int32_t tilt_mdeg;      // estimated pitch in millidegrees, positive tilts right
+    int32_t gyro_bias;      // gyro_y offset in raw counts
+    int32_t bias_sum;
+    int32_t rate_remainder; // sub-millidegree integration error carried over
+    int n_calibration;
+} imu_filter_t;
+
+// Function declarations
+void imu_filter_init(imu_filter_t *filter);
+void imu_filter_init_calibrated(imu_filter_t *filter, int32_t gyro_bias, const imu_raw_t *raw);
+bool imu_filter_calibrated(const imu_filter_t *filter);
+int32_t imu_filter_update(imu_filter_t *filter, const imu_raw_t *raw, uint32_t dt_us);
+int32_t imu_atan2_mdeg(int32_t y, int32_t x);
+
+#endif
@@ -0,0 +1,124 @@
+#include "imu_sampler.h"
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#define NS_PER_SEC (1000 * 1000 * 1000LL)
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NS_PER_SEC + now.tv_nsec;
+}
+
+// Publish one sample, dropped if the consumer has not made room
+static void publish(imu_sampler_t *sampler, const imu_data_t *data, uint64_t timestamp_ns) {
+    uint32_t head = sampler->head;
+    uint32_t tail = __atomic_load_n(&sampler->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail >= IMU_SAMPLER_RING_SIZE) {
+        __atomic_fetch_add(&sampler->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    sampler->ring[head & (IMU_SAMPLER_RING_SIZE - 1)].data = *data;
+    sampler->ring[head & (IMU_SAMPLER_RING_SIZE - 1)].timestamp_ns = timestamp_ns;
+    __atomic_store_n(&sampler->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Read whatever is due this period, returns -1 on an I2C failure
+static int sample_once(imu_sampler_t *sampler) {
+    imu_data_t samples[IMU_FIFO_MAX_SAMPLES];
+    uint64_t timestamp_ns;
+    uint64_t sample_period_ns;
+    int n_samples;
+    int i;
+
+    if (sampler->fifo_rate_div < 0) {
+        if (imu_read_into(sampler->file_handle, &samples[0]) < 0) {
+            return -1;
+        }
+        publish(sampler, &samples[0], now_ns());
+        return 0;
+    }
+
+    n_samples = imu_read_batch(sampler->file_handle, samples, IMU_FIFO_MAX_SAMPLES);
+    if (n_samples < 0) {
+        return -1;
+    }
+
+    // The newest sample was taken about now, the others one output period apart
+    timestamp_ns = now_ns();
+    sample_period_ns = NS_PER_SEC * (1 + sampler->fifo_rate_div) / IMU_GYRO_ODR_BASE_HZ;
+    for (i = 0; i < n_samples; i++) {
+        publish(sampler, &samples[i], timestamp_ns - (n_samples - 1 - i) * sample_period_ns);
+    }
+    return 0;
+}
+
+static void *sampler_thread(void *arg) {
+    imu_sampler_t *sampler = arg;
+    long long period_ns = NS_PER_SEC / sampler->rate_hz;
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    while (__atomic_load_n(&sampler->running, __ATOMIC_ACQUIRE)) {
+        if (sample_once(sampler) < 0) {
+            __atomic_store_n(&sampler->error, errno ? errno : EIO, __ATOMIC_RELEASE);
+            break;
+        }
+
+        // Absolute deadlines, a slow read shortens the next sleep
+        deadline.tv_nsec += period_ns;
+        while (deadline.tv_nsec >= NS_PER_SEC) {
+            deadline.tv_nsec -= NS_PER_SEC;
+            deadline.tv_sec++;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+        }
+    }
+    return NULL;
+}
+
+// Start sampling file_handle at rate_hz, which must already be initialized
+// with imu_init, or imu_init_fifo when fifo_rate_div is not -1. The thread
+// owns the fd until imu_sampler_stop. Returns 0 or an errno value.
+int imu_sampler_start(imu_sampler_t *sampler, int file_handle, int rate_hz, int fifo_rate_div) {
+    memset(sampler, 0, sizeof(*sampler));
+    sampler->file_handle = file_handle;
+    sampler->rate_hz = rate_hz;
+    sampler->fifo_rate_div = fifo_rate_div;
+    sampler->running = 1;
+
+    return pthread_create(&sampler->thread, NULL, sampler_thread, sampler);
+}
+
+void imu_sampler_stop(imu_sampler_t *sampler) {
+    __atomic_store_n(&sampler->running, 0, __ATOMIC_RELEASE);
+    pthread_join(sampler->thread, NULL);
+}
+
+// Take up to max_samples published samples, oldest first, without blocking.
+// Returns the number taken, or -1 with errno set once the ring is empty and
+// the thread stopped on an error.
+int imu_sampler_poll(imu_sampler_t *sampler, imu_sample_t *samples, int max_samples) {
+    uint32_t tail = sampler->tail;
+    uint32_t head = __atomic_load_n(&sampler->head, __ATOMIC_ACQUIRE);
+    int n_samples = 0;
+    int error;
+
+    while (tail != head && n_samples < max_samples) {
+        samples[n_samples++] = sampler->ring[tail & (IMU_SAMPLER_RING_SIZE - 1)];
+        tail++;
+    }
+    __atomic_store_n(&sampler->tail, tail, __ATOMIC_RELEASE);
+
+    if (n_samples == 0) {
+        error = __atomic_load_n(&sampler->error, __ATOMIC_ACQUIRE);
+        if (error) {
+            errno = error;
+            return -1;
+        }
+    }
+    return n_samples;
+}
@@ -0,0 +1,41 @@
+#ifndef IMU_SAMPLER_H
+#define IMU_SAMPLER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "imu_driver.h"
+
+// Number of samples the ring holds, must be a power of two
+#define IMU_SAMPLER_RING_SIZE 64
+
+// Data structure definitions
+typedef struct {
+    imu_data_t data;
+    uint64_t timestamp_ns;  // CLOCK_MONOTONIC time the sample was taken
+} imu_sample_t;
+
+// A thread that owns the I2C fd and publishes samples into a single-producer,
+// single-consumer ring. head is written by the sampler thread only and tail
+// by the consumer only, so no lock is needed.
+typedef struct {
+    int file_handle;
+    int rate_hz;
+    int fifo_rate_div;      // -1 to poll one sample at a time
+    pthread_t thread;
+    int running;            // cleared to stop the thread
+    int error;              // errno of the failure that stopped the thread, 0 if none
+    uint32_t dropped;       // samples lost because the consumer fell behind
+    uint32_t head;
+    uint32_t pad0[15];      // keep head and tail on separate cache lines
+    uint32_t tail;
+    uint32_t pad1[15];
+    imu_sample_t ring[IMU_SAMPLER_RING_SIZE];
+} imu_sampler_t;
+
+// Function declarations
+int imu_sampler_start(imu_sampler_t *sampler, int file_handle, int rate_hz, int fifo_rate_div);
+void imu_sampler_stop(imu_sampler_t *sampler);
+int imu_sampler_poll(imu_sampler_t *sampler, imu_sample_t *samples, int max_samples);
+
+#endif
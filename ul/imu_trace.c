@@ -0,0 +1,125 @@
+#include "imu_trace.h"
+#include <errno.h>
+#include <string.h>
+
+// Start a new trace at path, replacing any file there
+int imu_trace_create(imu_trace_t *trace, const char *path, const imu_trace_header_t *header) {
+    trace->file = fopen(path, "wb");
+    if (trace->file == NULL) {
+        return -1;
+    }
+    trace->writing = true;
+    trace->has_next = false;
+    if (fwrite(header, sizeof(*header), 1, trace->file) != 1) {
+        fclose(trace->file);
+        return -1;
+    }
+    return 0;
+}
+
+// Open a trace for replay and read its header
+int imu_trace_open(imu_trace_t *trace, const char *path, imu_trace_header_t *header) {
+    trace->file = fopen(path, "rb");
+    if (trace->file == NULL) {
+        return -1;
+    }
+    trace->writing = false;
+    trace->has_next = false;
+    if (fread(header, sizeof(*header), 1, trace->file) != 1 ||
+        memcmp(header->magic, IMU_TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != IMU_TRACE_VERSION || header->rate_hz == 0) {
+        fclose(trace->file);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+// Close the file, when writing this is where buffered records fail to land
+int imu_trace_close(imu_trace_t *trace) {
+    int ret = fclose(trace->file);
+    trace->file = NULL;
+    return ret;
+}
+
+int imu_trace_write(imu_trace_t *trace, imu_trace_type_t type, uint32_t value, const imu_raw_t *raw) {
+    imu_trace_record_t record;
+
+    memset(&record, 0, sizeof(record));
+    record.type = type;
+    record.value = value;
+    if (raw != NULL) {
+        record.raw = *raw;
+    }
+    return fwrite(&record, sizeof(record), 1, trace->file) == 1 ? 0 : -1;
+}
+
+// Look at the next record without consuming it. Returns 1 if there is one,
+// 0 at the end of the trace and -1 on a read error. A record cut short, say
+// by a crash while recording, ends the trace.
+static int trace_peek(imu_trace_t *trace, imu_trace_record_t *record) {
+    if (!trace->has_next) {
+        if (fread(&trace->next, sizeof(trace->next), 1, trace->file) != 1) {
+            return ferror(trace->file) ? -1 : 0;
+        }
+        trace->has_next = true;
+    }
+    *record = trace->next;
+    return 1;
+}
+
+static int trace_read(imu_trace_t *trace, imu_trace_record_t *record) {
+    int ret = trace_peek(trace, record);
+    trace->has_next = false;
+    return ret;
+}
+
+// Feed the samples up to the next frame or game to the filter, returns how
+// many there were or -1 on a read error
+int imu_trace_replay_samples(imu_trace_t *trace, imu_filter_t *filter) {
+    imu_trace_record_t record;
+    int n_samples = 0;
+    int ret;
+
+    while ((ret = trace_peek(trace, &record)) > 0 && record.type == IMU_TRACE_SAMPLE) {
+        trace_read(trace, &record);
+        imu_filter_update(filter, &record.raw, record.value);
+        n_samples++;
+    }
+    return ret < 0 ? -1 : n_samples;
+}
+
+// Loop periods covered by the next frame of the current game, 0 once its
+// frames run out and -1 on a read error. Samples left before it are filtered.
+int imu_trace_replay_frame(imu_trace_t *trace, imu_filter_t *filter) {
+    imu_trace_record_t record;
+    int ret;
+
+    if (imu_trace_replay_samples(trace, filter) < 0) {
+        return -1;
+    }
+    ret = trace_peek(trace, &record);
+    if (ret <= 0 || record.type != IMU_TRACE_FRAME) {
+        return ret < 0 ? -1 : 0;
+    }
+    trace_read(trace, &record);
+    return record.value;
+}
+
+// Skip to the start of the next game and return its difficulty, 0 at the end
+// of the trace and -1 on a read error. Skipped samples are still filtered so
+// the tilt estimate is where it was when that game was recorded.
+int imu_trace_replay_game(imu_trace_t *trace, imu_filter_t *filter) {
+    imu_trace_record_t record;
+    int ret;
+
+    while ((ret = trace_read(trace, &record)) > 0) {
+        if (record.type == IMU_TRACE_GAME) {
+            return record.value;
+        }
+        if (record.type == IMU_TRACE_SAMPLE) {
+            imu_filter_update(filter, &record.raw, record.value);
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,58 @@
+#ifndef IMU_TRACE_H
+#define IMU_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "imu_filter.h"
+
+/*
+ * Binary trace of a game session: a header, then fixed-size records in the
+ * order the game loop saw them. Every IMU sample is stored as the raw counts
+ * fed to the tilt filter together with the dt it was filtered with, and every
+ * frame as the number of loop periods it covered, so a replay reproduces the
+ * character positions and, with the same seed, the spawns exactly.
+ * Fields are in host byte order, little-endian on the board and on x86, and
+ * both structs are laid out without padding.
+ */
+#define IMU_TRACE_MAGIC     "MTRC"
+#define IMU_TRACE_VERSION   1
+
+typedef struct {
+    char magic[4];          // IMU_TRACE_MAGIC
+    uint16_t version;       // IMU_TRACE_VERSION
+    uint16_t rate_hz;       // game loop rate, a frame period is 1 s / rate_hz
+    uint32_t seed;          // srand() seed of the session
+} imu_trace_header_t;
+
+typedef enum {
+    IMU_TRACE_SAMPLE = 1,   // value: dt_us the sample was filtered with
+    IMU_TRACE_FRAME = 2,    // value: loop periods the frame covered
+    IMU_TRACE_GAME = 3,     // value: starting difficulty of a new game
+} imu_trace_type_t;
+
+typedef struct {
+    uint8_t type;           // imu_trace_type_t
+    uint8_t reserved[3];
+    uint32_t value;
+    imu_raw_t raw;          // IMU_TRACE_SAMPLE only, zero otherwise
+} imu_trace_record_t;
+
+typedef struct {
+    FILE *file;
+    bool writing;
+    bool has_next;          // next holds a record peeked at but not consumed
+    imu_trace_record_t next;
+} imu_trace_t;
+
+// Function declarations
+int imu_trace_create(imu_trace_t *trace, const char *path, const imu_trace_header_t *header);
+int imu_trace_open(imu_trace_t *trace, const char *path, imu_trace_header_t *header);
+int imu_trace_close(imu_trace_t *trace);
+int imu_trace_write(imu_trace_t *trace, imu_trace_type_t type, uint32_t value, const imu_raw_t *raw);
+int imu_trace_replay_game(imu_trace_t *trace, imu_filter_t *filter);
+int imu_trace_replay_frame(imu_trace_t *trace, imu_filter_t *filter);
+int imu_trace_replay_samples(imu_trace_t *trace, imu_filter_t *filter);
+
+#endif
@@ -8,14 +8,51 @@
 #include <errno.h>
 
 #include "imu_driver.h"
+#include "imu_filter.h"
+#include "imu_sampler.h"
+#include "imu_trace.h"
+#include "meteor_dev.h"
+#include "meteor_game.h"
+#include "profiler.h"
 
 
 #define I2C_BUS_FILE "/dev/i2c-2"
 
-static int difficulty_lvl = 1;
+#define NS_PER_SEC (1000 * 1000 * 1000LL)
+#define DEFAULT_RATE_HZ 60
+//1100 / (1 + 4) = 220 Hz gyro rate in FIFO mode, almost 4 samples per frame at 60 Hz
+#define IMU_FIFO_RATE_DIV 4
+//how often the sampler thread reads the IMU
+#define IMU_SAMPLER_RATE_HZ 200
+//time between reads while measuring the gyro bias
+#define CALIBRATION_PERIOD_US 5000
+
+static imu_filter_t tilt_filter;
+//with -t every sample the filter sees and every frame go to a trace, -R replays one
+static imu_trace_t trace;
+static bool recording = false;
+static bool replaying = false;
+//with -s the imu belongs to the sampler thread until we exit
+static imu_sampler_t sampler;
+static bool sampling = false;
+
+//flush a recorded trace, a replayed one is just closed
+static void close_trace_at_exit(void) {
+	if (trace.file != NULL && imu_trace_close(&trace) != 0 && recording) {
+		perror("Failed to write IMU trace");
+	}
+}
 
+//join the sampler thread and close the imu it was reading
+static void stop_sampler_at_exit(void) {
+	if (sampling) {
+		imu_sampler_stop(&sampler);
+		close(sampler.file_handle);
+		sampling = false;
+	}
+}
 
-int init_imu() {
+int init_imu(bool use_fifo) {
 	int imu_status;
 	int imu_file_handle;
 	if ((imu_file_handle = open(I2C_BUS_FILE, O_RDWR)) < 0) {
@@ -23,7 +60,12 @@ int init_imu() {
 		return -1;
 	}
 
-	imu_status = imu_init(imu_file_handle);
+	if (use_fifo) {
+		imu_status = imu_init_fifo(imu_file_handle, IMU_FIFO_RATE_DIV);
+	}
+	else {
+		imu_status = imu_init(imu_file_handle);
+	}
 	if (imu_status != 0) {
 		perror("Could not initialize IMU device\n");
 		return -1;
@@ -32,200 +74,501 @@ int init_imu() {
 	return imu_file_handle;
 }
 
+//feed one sample to the tilt filter, dt_us after the previous one
+void filter_imu(const imu_data_t *sample, uint32_t dt_us) {
+	imu_raw_t raw;
+
+	//back to register counts, the filter works in integers
+	raw.accel_x = (int16_t)(sample->accel_x * ACCEL_SCALE_FACTOR);
+	raw.accel_y = (int16_t)(sample->accel_y * ACCEL_SCALE_FACTOR);
+	raw.accel_z = (int16_t)(sample->accel_z * ACCEL_SCALE_FACTOR);
+	raw.gyro_x = (int16_t)(sample->gyro_x * GYRO_SCALE_FACTOR);
+	raw.gyro_y = (int16_t)(sample->gyro_y * GYRO_SCALE_FACTOR);
+	raw.gyro_z = (int16_t)(sample->gyro_z * GYRO_SCALE_FACTOR);
+
+	if (recording && imu_trace_write(&trace, IMU_TRACE_SAMPLE, dt_us, &raw) < 0) {
+		perror("Failed to record IMU trace, recording stopped");
+		recording = false;
+	}
+	imu_filter_update(&tilt_filter, &raw, dt_us);
+}
 
-int calc_travel_pos(imu_data_t imu_data, int curr_pos) {
-	int delta_x;
-	int scaling = 5;
-	delta_x = (int)(-1 * imu_data.gyro_x / scaling) * difficulty_lvl;
-	//delta_x = (int)(imu_data.gyro_y / scaling) * difficulty_lvl;
-	//delta_x = (int)(imu_data.gyro_z / scaling) * difficulty_lvl;
-	
-	curr_pos = curr_pos + delta_x;
-	if (curr_pos > 450) {
-		curr_pos = 450;
+//filter everything the sensor queued since the last frame
+int read_imu_fifo(int imu_file_handle) {
+	imu_data_t samples[IMU_FIFO_MAX_SAMPLES];
+	uint32_t sample_period_us = 1000000 * (1 + IMU_FIFO_RATE_DIV) / IMU_GYRO_ODR_BASE_HZ;
+	int n_samples;
+	int i;
+
+	n_samples = imu_read_batch(imu_file_handle, samples, IMU_FIFO_MAX_SAMPLES);
+	for (i = 0; i < n_samples; i++) {
+		filter_imu(&samples[i], sample_period_us);
+	}
+	return n_samples;
+}
+
+//same for everything the sampler thread published, never blocks
+int read_imu_sampler(imu_sampler_t *sampler) {
+	static uint64_t last_timestamp_ns;
+	imu_sample_t samples[IMU_SAMPLER_RING_SIZE];
+	int n_samples;
+	int i;
+
+	n_samples = imu_sampler_poll(sampler, samples, IMU_SAMPLER_RING_SIZE);
+	for (i = 0; i < n_samples; i++) {
+		filter_imu(&samples[i].data,
+				   last_timestamp_ns ? (samples[i].timestamp_ns - last_timestamp_ns) / 1000 : 0);
+		last_timestamp_ns = samples[i].timestamp_ns;
+	}
+	return n_samples;
+}
+
+//one blocking read, dt_us after the previous one
+int read_imu_polled(int imu_file_handle, uint32_t dt_us) {
+	imu_data_t sample;
+
+	if (imu_read_into(imu_file_handle, &sample) < 0) {
+		return -1;
 	}
-	else if (curr_pos < 0) {
-		curr_pos = 0;
+	filter_imu(&sample, dt_us);
+	return 1;
+}
+
+//measure the gyro bias before the game starts, the board has to lie still
+int calibrate_imu(int imu_file_handle, bool use_fifo) {
+	printf("Calibrating, hold still...\n");
+	while (!imu_filter_calibrated(&tilt_filter)) {
+		usleep(CALIBRATION_PERIOD_US);
+		if (use_fifo) {
+			if (read_imu_fifo(imu_file_handle) < 0) {
+				return -1;
+			}
+		}
+		else if (read_imu_polled(imu_file_handle, CALIBRATION_PERIOD_US) < 0) {
+			return -1;
+		}
 	}
+	return 0;
+}
 
-	return curr_pos;
+
+void timespec_add_ns(struct timespec *ts, long long ns) {
+	ns += ts->tv_nsec;
+	ts->tv_sec += ns / NS_PER_SEC;
+	ts->tv_nsec = ns % NS_PER_SEC;
 }
 
-int rand_spawn_meteor() {
-	int max = 420;
-	int min = 0;
-	int odds = 200;
-	int rand_chance;
-	int rand_pos;
+long long timespec_diff_ns(const struct timespec *a, const struct timespec *b) {
+	return (a->tv_sec - b->tv_sec) * NS_PER_SEC + (a->tv_nsec - b->tv_nsec);
+}
 
-	odds = odds / (4 * difficulty_lvl);
-	rand_chance = (rand() % (odds)) + 1;
-	
-	if (rand_chance == 1) {
-		rand_pos = (rand() % (max - min + 1)) + min;
+//sleep until the next deadline and return the game time in ns the frame covers.
+//deadlines are absolute so the work done in a frame does not add to the period.
+//if we fell behind by whole periods they are skipped, the frame then covers
+//all of them so game time keeps up with real time. overshoot_ns is how late
+//we woke up
+long long wait_next_frame(struct timespec *deadline, long long period_ns, unsigned *overruns,
+						  long long *overshoot_ns) {
+	struct timespec now;
+	long long late_ns;
+	long long missed;
+
+	timespec_add_ns(deadline, period_ns);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR) {
 	}
-	else {
-		rand_pos = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	late_ns = timespec_diff_ns(&now, deadline);
+	*overshoot_ns = late_ns;
+	if (late_ns < period_ns) {
+		return period_ns;
 	}
 
-	return rand_pos;
+	missed = late_ns / period_ns;
+	*overruns += missed;
+	timespec_add_ns(deadline, missed * period_ns);
+	return (missed + 1) * period_ns;
 }
 
+//sleep until a replayed frame is due, frames keep their recorded length
+void wait_replay_frame(struct timespec *deadline, long long frame_ns, long long *overshoot_ns) {
+	struct timespec now;
 
+	timespec_add_ns(deadline, frame_ns);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR) {
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	*overshoot_ns = timespec_diff_ns(&now, deadline);
+}
+
+//hand the commands the last game step queued to the device
+void queue_game_cmds(meteor_dev_t *dev, game_t *game) {
+	int i;
+
+	for (i = 0; i < game->n_cmds; i++) {
+		meteor_dev_queue(dev, game->cmds[i].opcode, game->cmds[i].arg);
+	}
+	game->n_cmds = 0;
+}
+
+//drain the module's events, returns 1 once the character hit a meteor
+int check_collision(meteor_dev_t *dev) {
+	struct meteor_event events[METEOR_MAX_BATCH];
+	int n_events;
+	int i;
+
+	while ((n_events = meteor_dev_read_events(dev, events, METEOR_MAX_BATCH)) > 0) {
+		for (i = 0; i < n_events; i++) {
+			if (events[i].type == METEOR_EVENT_COLLISION) {
+				return 1;
+			}
+		}
+	}
+	return n_events;
+}
+
+void usage(const char *prog) {
+	printf("Usage: %s [-m] [-f] [-s] [-k] [-r rate] [-p csv] [-t trace] <difficulty 1-10>\n", prog);
+	printf("       %s [-m] [-p csv] [-x] -R trace\n", prog);
+	printf("  -m  send commands through the shared-memory ring instead of write()\n");
+	printf("  -f  queue IMU samples in the sensor FIFO and average them every frame\n");
+	printf("  -s  read the IMU on its own thread so I2C latency stays off the frame\n");
+	printf("  -k  let the module read the IMU and steer the character itself\n");
+	printf("  -r  game loop rate in Hz, default %d\n", DEFAULT_RATE_HZ);
+	printf("  -p  profile every frame and write the timings to a CSV file, also\n");
+	printf("      enabled by METEOR_PROFILE=<file> (empty for percentiles only)\n");
+	printf("  -t  record the IMU samples, frames and random seed to a trace file\n");
+	printf("  -R  replay a recorded trace instead of reading the IMU\n");
+	printf("  -x  replay as fast as possible instead of in real time\n");
+}
 
 int main(int argc, char **argv) {
+	bool use_ring = false;
+	bool use_fifo = false;
+	bool use_sampler = false;
+	bool kernel_input = false;
+	int rate_hz = DEFAULT_RATE_HZ;
+	const char *profile_csv = getenv("METEOR_PROFILE");
+	const char *record_path = NULL;
+	const char *replay_path = NULL;
+	bool replay_fast = false;
+	imu_trace_header_t trace_header;
+	unsigned seed;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "mfskr:p:t:R:x")) != -1) {
+		switch (opt) {
+		case 'm':
+			use_ring = true;
+			break;
+		case 'f':
+			use_fifo = true;
+			break;
+		case 's':
+			use_sampler = true;
+			break;
+		case 'k':
+			kernel_input = true;
+			break;
+		case 'p':
+			profile_csv = optarg;
+			break;
+		case 't':
+			record_path = optarg;
+			break;
+		case 'R':
+			replay_path = optarg;
+			break;
+		case 'x':
+			replay_fast = true;
+			break;
+		case 'r':
+			rate_hz = atoi(optarg);
+			if (rate_hz < 1 || rate_hz > 1000) {
+				printf("Rate must be between 1 and 1000 Hz\n");
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	//a trace holds what the game loop read from the imu, with -k the module reads it
+	if ((record_path || replay_path) && kernel_input) {
+		printf("Traces need the IMU read from userspace, -t and -R do not work with -k\n");
+		return 1;
+	}
+	if (record_path && replay_path) {
+		printf("Choose either -t or -R\n");
+		return 1;
+	}
+
+	//replays take the difficulty from the trace
+	if (replay_path) {
+		if (imu_trace_open(&trace, replay_path, &trace_header) < 0) {
+			perror("Failed to open IMU trace");
+			return 1;
+		}
+		replaying = true;
+		atexit(close_trace_at_exit);
+		rate_hz = trace_header.rate_hz;
+	}
+
 	//check to see if difficulty was set
-	if (argc != 2) {
+	else if (optind != argc - 1) {
 		printf("No difficulty selected!\nChoose between 1 - 10\n");
+		usage(argv[0]);
 		return 1;
 	}
 
-	//seed random choices
-	srand(time(NULL));
+	//report where the frame time goes when we exit
+	if (profile_csv && prof_init(profile_csv) < 0) {
+		perror("Failed to create profile CSV");
+		return 1;
+	}
+
+	//seed random choices, a replay repeats the recorded ones
+	seed = replaying ? trace_header.seed : (unsigned)time(NULL);
+	srand(seed);
+
+	//the trace is flushed when we exit
+	if (record_path) {
+		memcpy(trace_header.magic, IMU_TRACE_MAGIC, sizeof(trace_header.magic));
+		trace_header.version = IMU_TRACE_VERSION;
+		trace_header.rate_hz = rate_hz;
+		trace_header.seed = seed;
+		if (imu_trace_create(&trace, record_path, &trace_header) < 0) {
+			perror("Failed to create IMU trace");
+			return 1;
+		}
+		recording = true;
+		atexit(close_trace_at_exit);
+	}
 
 	//set difficulty level
-	difficulty_lvl = atoi(argv[1]);
+	if (replaying) {
+		imu_filter_init(&tilt_filter);
+		difficulty_lvl = imu_trace_replay_game(&trace, &tilt_filter);
+		if (difficulty_lvl <= 0) {
+			printf("IMU trace has no games\n");
+			return 1;
+		}
+	}
+	else {
+		difficulty_lvl = atoi(argv[optind]);
+	}
 	
-	int pFile;
+	meteor_dev_t dev;
 	FILE* highscore_file;
-	//pen device file
-	pFile = open("/dev/meteor_dash", O_WRONLY);
-
-	//error check for device opening
-	if (pFile < 0) {
+	//open device file and check for errors
+	if (meteor_dev_open(&dev, use_ring) < 0) {
         	printf("Error opening file!\n");
         	return 1;
     }
 
-	//initialize character position
-	int character_pos = 100;
-
-	//initialize imu
-	int imu_file_handle;
-	imu_file_handle = init_imu();
+	//initialize imu, the module reads it itself with -k
+	int imu_file_handle = -1;
+	if (!kernel_input && !replaying) {
+		imu_file_handle = init_imu(use_fifo);
 	
-	//error check for imu reading
-	if (imu_file_handle == -1) {
-		close(pFile);
-		return 1;
+		//error check for imu reading
+		if (imu_file_handle == -1) {
+			meteor_dev_close(&dev);
+			return 1;
+
+		}
+
+		//measure the gyro bias while the board is still
+		imu_filter_init(&tilt_filter);
+		if (calibrate_imu(imu_file_handle, use_fifo) < 0) {
+			perror("Failed to calibrate IMU");
+			meteor_dev_close(&dev);
+			return 1;
+		}
 
+		//hand the imu over to the sampler thread
+		if (use_sampler) {
+			errno = imu_sampler_start(&sampler, imu_file_handle, IMU_SAMPLER_RATE_HZ,
+									  use_fifo ? IMU_FIFO_RATE_DIV : -1);
+			if (errno != 0) {
+				perror("Failed to start IMU sampler");
+				meteor_dev_close(&dev);
+				return 1;
+			}
+			sampling = true;
+			atexit(stop_sampler_at_exit);
+		}
 	}
 
 	//init variables for loop
-	imu_data_t imu_reading;
-	int meteor_pos;
-
-	char buffer[32];
 	char score_buf[256];
 
-	//calc obs falling rate
-	int block_fallrate = 4 + (difficulty_lvl / 2);
-	
-	//send block falling rate into buffer to write
-	int bytes_written = sprintf(buffer, "-1,%d,", block_fallrate);
-
-	//write block falling rate to device file
-	size_t written_elements = write(pFile, buffer, bytes_written);
-	//error check
-	if (written_elements == -1) {
-		printf("Error writing difficulty fall rate\n");
-		close(pFile);
-		return 1;
-	}
+	long long period_ns = NS_PER_SEC / rate_hz;
+	long long frame_ns;
+	long long overshoot_ns;
+	unsigned overruns;
+	struct timespec deadline;
+	game_t game;
 
-	int score = 0;
 	int play = 1;
 	while (play == 1) {
 	int GAMEOVER = 0;
 	char play_again;
+	overruns = 0;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	//fall rate, input and level go out with the first frame, the module shows
+	//the level and score which both start at 0 on open
+	game_start(&game, kernel_input);
+	queue_game_cmds(&dev, &game);
+	if (recording) {
+		imu_trace_write(&trace, IMU_TRACE_GAME, difficulty_lvl, NULL);
+	}
 	//game loop
 	while (GAMEOVER == 0) {
 
-		//delay for --- msec maybe necessary?
-		usleep(50 * 1000);
-		score += difficulty_lvl;
-		if (((score % 400) == 0) && (difficulty_lvl < 10)){
-			difficulty_lvl += 1;
-			printf("Moving up in difficulty... current score: %d\n", score);
-			
-			int block_fallrate = 4 + (difficulty_lvl / 2);
-	
-			//send block falling rate into buffer to write
-			int bytes_written = sprintf(buffer, "-1,%d,", block_fallrate);
-
-			//write block falling rate to device file
-			size_t written_elements = write(pFile, buffer, bytes_written);
-			//error check
-			if (written_elements == -1) {
-				printf("Error writing difficulty fall rate\n");
-				close(pFile);
+		//wait for the next frame, a replayed one lasts as long as it did when recorded
+		if (replaying) {
+			int periods = imu_trace_replay_frame(&trace, &tilt_filter);
+			if (periods < 0) {
+				perror("Failed to read IMU trace");
+				meteor_dev_close(&dev);
 				return 1;
 			}
-		
+			if (periods == 0) {
+				printf("Recorded game ended here, score: %d\n", game.score);
+				meteor_dev_close(&dev);
+				break;
+			}
+			frame_ns = periods * period_ns;
+			if (replay_fast) {
+				overshoot_ns = 0;
+			}
+			else {
+				wait_replay_frame(&deadline, frame_ns, &overshoot_ns);
+			}
 		}
+		else {
+			frame_ns = wait_next_frame(&deadline, period_ns, &overruns, &overshoot_ns);
+			if (recording) {
+				imu_trace_write(&trace, IMU_TRACE_FRAME, frame_ns / period_ns, NULL);
+			}
+		}
+		prof_frame_begin(overshoot_ns);
 
-		//read imu data
-		imu_reading = imu_read(imu_file_handle);
-		
-		//calculate change in position
-		character_pos = calc_travel_pos(imu_reading, character_pos);
-		
+		//score and difficulty advance per 50 ms of game time, a level up sends
+		//the new fall rate with this frame's update
+		if (game_frame_score(&game, frame_ns)) {
+			printf("Moving up in difficulty... current score: %d\n", game.score);
+		}
+		prof_mark(PROF_LOGIC);
+
+		//steer from userspace unless the module does
+		if (!kernel_input) {
+			//read imu data
+			int imu_status;
+			if (replaying) {
+				imu_status = imu_trace_replay_samples(&trace, &tilt_filter);
+			}
+			else if (use_sampler) {
+				imu_status = read_imu_sampler(&sampler);
+			}
+			else if (use_fifo) {
+				imu_status = read_imu_fifo(imu_file_handle);
+			}
+			else {
+				imu_status = read_imu_polled(imu_file_handle, frame_ns / 1000);
+			}
+			if (imu_status < 0) {
+				perror("Failed to read IMU data");
+				meteor_dev_close(&dev);
+				return 1;
+			}
+			prof_mark(PROF_IMU);
+		}
 
-		//randomly spawn a meteor at a random location
-		meteor_pos = rand_spawn_meteor();
+		//calculate change in position and randomly spawn a meteor
+		game_frame_move(&game, tilt_filter.tilt_mdeg, frame_ns);
+		prof_mark(PROF_LOGIC);
 
-		//format data to write to device file
-		int bytes_written = sprintf(buffer, "%d,%d,", character_pos, meteor_pos);
+		//queue this frame's updates
+		queue_game_cmds(&dev, &game);
+		prof_mark(PROF_FORMAT);
 
 		//write latest data to device file
-		size_t written_elements = write(pFile, buffer, bytes_written);
+		int written_elements = meteor_dev_submit(&dev);
 		int err_num = errno;
+		prof_mark(PROF_WRITE);
 		//error check
-		//check for termination signal
-		if (written_elements == -1) {
-			if (err_num == 2) {
-				err_num = 0;
-				printf("GAME OVER! YOU HIT A METEOR!\n");
-				printf("Your score was: %d\n", score);
-				close(pFile);
-				
-				highscore_file = fopen("leaderboard.txt", "r+");
-				if (highscore_file == NULL) {
-					printf("error accessing leaderboard. SORRY!\n");
-					return 1;
-				}
-				
-				fgets(score_buf, sizeof(score_buf), highscore_file);
-				fclose(highscore_file);
-				if (atoi(score_buf) < score) {
-					printf("New Highscore! Congrats!\n");
-					fopen("leaderboard.txt", "w");
-					fprintf(highscore_file, "%d\n", score);
-					fclose(highscore_file);
-				}
-				
-				GAMEOVER = 1;
+		if (written_elements == -1 && err_num != 2) {
+			printf("Error writing elements\n");
+			meteor_dev_close(&dev);
+			return 1;
+		}
+
+		//check for termination signal, the module reports the collision on the
+		//tick it happens even if we did not move
+		int collided = check_collision(&dev);
+		prof_mark(PROF_EVENTS);
+		prof_frame_end();
+		if (collided < 0) {
+			perror("Error reading game events");
+			meteor_dev_close(&dev);
+			return 1;
+		}
+		if (written_elements == -1 || collided) {
+			printf("GAME OVER! YOU HIT A METEOR!\n");
+			printf("Your score was: %d\n", game.score);
+			if (overruns > 0) {
+				printf("Missed %u frames at %d Hz\n", overruns, rate_hz);
 			}
-			else {
-				printf("Error writing elements\n");
-				close(pFile);
+			meteor_dev_close(&dev);
+			
+			//a replay is not a new score
+			if (replaying) {
+				break;
+			}
+
+			highscore_file = fopen("leaderboard.txt", "r+");
+			if (highscore_file == NULL) {
+				printf("error accessing leaderboard. SORRY!\n");
 				return 1;
 			}
+			
+			fgets(score_buf, sizeof(score_buf), highscore_file);
+			fclose(highscore_file);
+			if (atoi(score_buf) < game.score) {
+				printf("New Highscore! Congrats!\n");
+				fopen("leaderboard.txt", "w");
+				fprintf(highscore_file, "%d\n", game.score);
+				fclose(highscore_file);
+			}
+			
+			GAMEOVER = 1;
 		}
 
 	}
-	printf("Play again? (y/n) \n");
-	scanf(" %c", &play_again);
+	//a replay plays every game in the trace
+	if (replaying) {
+		play_again = 'y';
+		difficulty_lvl = imu_trace_replay_game(&trace, &tilt_filter);
+		if (difficulty_lvl <= 0) {
+			printf("Replay finished\n");
+			return difficulty_lvl < 0 ? 1 : 0;
+		}
+	}
+	else {
+		printf("Play again? (y/n) \n");
+		scanf(" %c", &play_again);
+		difficulty_lvl = 1;
+	}
 	
 	if (play_again == 'y') {
 		play = 1;
 		GAMEOVER = 0;
-		score = 0;
-		difficulty_lvl = 1;
-		pFile = open("/dev/meteor_dash", O_WRONLY);
-
 		//error check for device opening
-		if (pFile < 0) {
+		if (meteor_dev_open(&dev, use_ring) < 0) {
         		printf("Error opening file!\n");
         		return 1;
     		}
@@ -0,0 +1,180 @@
+#include "meteor_dev.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Map the command ring and the game state page, falls back to write() on failure
+static int map_ring(meteor_dev_t *dev) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    void *ring;
+    void *state;
+
+    ring = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd,
+                METEOR_MMAP_RING_PGOFF * page_size);
+    if (ring == MAP_FAILED) {
+        return -1;
+    }
+
+    state = mmap(NULL, page_size, PROT_READ, MAP_SHARED, dev->fd,
+                 METEOR_MMAP_STATE_PGOFF * page_size);
+    if (state == MAP_FAILED) {
+        munmap(ring, page_size);
+        return -1;
+    }
+
+    dev->ring = ring;
+    dev->state = state;
+    return 0;
+}
+
+int meteor_dev_open(meteor_dev_t *dev, bool use_ring) {
+    memset(dev, 0, sizeof(*dev));
+
+    // Non-blocking so reading events never stalls a frame, write() never blocks anyway
+    dev->fd = open(METEOR_DASH_DEVICE, O_RDWR | O_NONBLOCK);
+    if (dev->fd < 0) {
+        return -1;
+    }
+
+    if (use_ring && map_ring(dev) != 0) {
+        perror("Failed to map command ring, using write()");
+    }
+
+    return 0;
+}
+
+void meteor_dev_close(meteor_dev_t *dev) {
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    if (dev->ring) {
+        munmap(dev->ring, page_size);
+        munmap((void *)dev->state, page_size);
+    }
+    close(dev->fd);
+    dev->fd = -1;
+    dev->ring = NULL;
+    dev->state = NULL;
+}
+
+// Position updates and spawns, the next frame brings fresh ones if these are lost
+static bool cmd_droppable(const struct meteor_cmd *cmd) {
+    return cmd->opcode == METEOR_CMD_SET_CHAR_X || cmd->opcode == METEOR_CMD_SPAWN;
+}
+
+// Drop the droppable commands and keep the rest queued for the next submit
+static void drop_input(meteor_dev_t *dev) {
+    int n = 0;
+    int i;
+
+    for (i = 0; i < dev->n_cmds; i++) {
+        if (!cmd_droppable(&dev->cmds[i])) {
+            dev->cmds[n++] = dev->cmds[i];
+        }
+    }
+    dev->n_cmds = n;
+}
+
+// Queue a command for the next submit. Returns 0 on success and -1 with errno
+// set to ENOSPC if a full batch of state changes is already waiting.
+int meteor_dev_queue(meteor_dev_t *dev, uint8_t opcode, int32_t arg) {
+    struct meteor_cmd *cmd;
+    int i;
+
+    // Only the latest score and level matter, update one still waiting
+    if (opcode == METEOR_CMD_SET_SCORE || opcode == METEOR_CMD_SET_LEVEL) {
+        for (i = 0; i < dev->n_cmds; i++) {
+            if (dev->cmds[i].opcode == opcode) {
+                dev->cmds[i].arg = arg;
+                return 0;
+            }
+        }
+    }
+
+    if (dev->n_cmds == METEOR_MAX_BATCH) {
+        drop_input(dev);
+    }
+    if (dev->n_cmds == METEOR_MAX_BATCH) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    cmd = &dev->cmds[dev->n_cmds++];
+    cmd->version = METEOR_DASH_VERSION;
+    cmd->opcode = opcode;
+    cmd->reserved = 0;
+    cmd->arg = arg;
+    return 0;
+}
+
+// Publish the queued commands in the shared ring, returns -1 if it is full
+static int ring_push(meteor_dev_t *dev) {
+    struct meteor_ring *ring = dev->ring;
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    int i;
+
+    if (METEOR_RING_SIZE - (head - tail) < (uint32_t)dev->n_cmds) {
+        return -1;
+    }
+
+    for (i = 0; i < dev->n_cmds; i++) {
+        ring->cmds[(head + i) & (METEOR_RING_SIZE - 1)] = dev->cmds[i];
+    }
+
+    // Make the slots visible before the module sees the new head
+    __atomic_store_n(&ring->head, head + dev->n_cmds, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Send every queued command and empty the queue. Returns 0 on success and -1
+// with errno set on failure, errno is ENOENT once the character hit a meteor.
+int meteor_dev_submit(meteor_dev_t *dev) {
+    ssize_t written;
+
+    if (dev->state && dev->state->collision) {
+        dev->n_cmds = 0;
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (dev->n_cmds == 0) {
+        return 0;
+    }
+
+    // Without a syscall when the ring is mapped. Falling back to write() here
+    // could overtake commands still in the ring, the module drains write()s first.
+    if (dev->ring) {
+        if (ring_push(dev) != 0) {
+            // The module is behind on input, state changes wait for the next frame
+            drop_input(dev);
+            return 0;
+        }
+        dev->n_cmds = 0;
+        return 0;
+    }
+
+    // One write() for the whole frame otherwise
+    written = write(dev->fd, dev->cmds, dev->n_cmds * sizeof(dev->cmds[0]));
+    if (written < 0 && errno == EAGAIN) {
+        // Nothing was queued, same as a full ring
+        drop_input(dev);
+        return 0;
+    }
+    dev->n_cmds = 0;
+    return written < 0 ? -1 : 0;
+}
+
+// Take the events queued by the module without blocking. Returns the number
+// of events read, 0 if there are none, or -1 with errno set on failure.
+int meteor_dev_read_events(meteor_dev_t *dev, struct meteor_event *events, int max_events) {
+    ssize_t n_read;
+
+    n_read = read(dev->fd, events, max_events * sizeof(events[0]));
+    if (n_read < 0) {
+        return errno == EAGAIN ? 0 : -1;
+    }
+    return n_read / sizeof(events[0]);
+}
@@ -0,0 +1,28 @@
+#ifndef METEOR_DEV_H
+#define METEOR_DEV_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "meteor_dash.h"
+
+// Handle on /dev/meteor_dash plus the commands queued for the current frame.
+// With the ring mapped every command goes through it, never through write(),
+// so the module applies them in the order they were queued.
+typedef struct {
+    int fd;
+    struct meteor_ring *ring;                   // NULL when commands go through write()
+    const volatile struct meteor_state *state;  // NULL when the ring is not mapped
+    struct meteor_cmd cmds[METEOR_MAX_BATCH];
+    int n_cmds;
+} meteor_dev_t;
+
+// Function declarations
+int meteor_dev_open(meteor_dev_t *dev, bool use_ring);
+void meteor_dev_close(meteor_dev_t *dev);
+int meteor_dev_queue(meteor_dev_t *dev, uint8_t opcode, int32_t arg);
+int meteor_dev_submit(meteor_dev_t *dev);
+int meteor_dev_read_events(meteor_dev_t *dev, struct meteor_event *events, int max_events);
+
+#endif
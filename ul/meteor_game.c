@@ -0,0 +1,130 @@
+#include "meteor_game.h"
+#include <stdlib.h>
+
+// Game rules of the userspace loop, shared by ul/meteor and the sim/ build
+
+int difficulty_lvl = 1;
+
+// frame_ns is the game time covered by this frame, movement is scaled so the
+// speed is the same at any loop rate
+int calc_travel_pos(int32_t tilt_mdeg, int curr_pos, long long frame_ns) {
+    int delta_x;
+    // The tilt sets the velocity, the same way the module steers
+    delta_x = (int)((long long)tilt_mdeg * METEOR_TILT_SPEED * difficulty_lvl * frame_ns / STEP_NS / 1000000);
+
+    curr_pos = curr_pos + delta_x;
+    if (curr_pos > 450) {
+        curr_pos = 450;
+    } else if (curr_pos < 0) {
+        curr_pos = 0;
+    }
+
+    return curr_pos;
+}
+
+// The chance of a spawn is 1 in odds per 50 ms step, scaled to frame_ns
+int rand_spawn_meteor(long long frame_ns) {
+    int max = 420;
+    int min = 0;
+    int odds = 200;
+    double chance;
+    int rand_pos;
+
+    odds = odds / (4 * difficulty_lvl);
+    chance = (double)frame_ns / STEP_NS / odds;
+
+    if (rand() < chance * RAND_MAX) {
+        rand_pos = (rand() % (max - min + 1)) + min;
+    } else {
+        rand_pos = -1;
+    }
+
+    return rand_pos;
+}
+
+// Meteor fall rate in pixels per tick for the current difficulty
+int game_fall_rate(void) {
+    return 4 + (difficulty_lvl / 2);
+}
+
+// Score and difficulty advance per 50 ms of game time. Returns true if the
+// difficulty went up, the caller then sends the new fall rate.
+bool game_advance_score(long long frame_ns, long long *score_ns, int *score) {
+    bool level_up = false;
+
+    *score_ns += frame_ns;
+    while (*score_ns >= STEP_NS) {
+        *score_ns -= STEP_NS;
+        *score += difficulty_lvl;
+        if (((*score % 400) == 0) && (difficulty_lvl < MAX_DIFFICULTY)) {
+            difficulty_lvl += 1;
+            level_up = true;
+        }
+    }
+    return level_up;
+}
+
+static void game_queue(game_t *game, uint8_t opcode, int32_t arg) {
+    struct meteor_cmd *cmd;
+
+    if (game->n_cmds == GAME_MAX_CMDS) {
+        return;
+    }
+    cmd = &game->cmds[game->n_cmds++];
+    cmd->version = METEOR_DASH_VERSION;
+    cmd->opcode = opcode;
+    cmd->reserved = 0;
+    cmd->arg = arg;
+}
+
+// Difficulty dependent settings, sent when a game starts and on every level up
+static void game_queue_difficulty(game_t *game) {
+    game_queue(game, METEOR_CMD_SET_FALL_RATE, game_fall_rate());
+    if (game->kernel_input) {
+        game_queue(game, METEOR_CMD_SET_INPUT, difficulty_lvl);
+    }
+    game_queue(game, METEOR_CMD_SET_LEVEL, difficulty_lvl);
+}
+
+// Start a game at difficulty_lvl, the module has just been opened. With
+// kernel_input the module reads the IMU and steers the character itself.
+void game_start(game_t *game, bool kernel_input) {
+    game->kernel_input = kernel_input;
+    game->score = 0;
+    game->sent_score = 0;
+    game->score_ns = 0;
+    game->character_pos = GAME_START_POS;
+    game->n_cmds = 0;
+    game_queue_difficulty(game);
+}
+
+// First half of a frame covering frame_ns of game time: scoring and the
+// difficulty. Returns true if the difficulty went up.
+bool game_frame_score(game_t *game, long long frame_ns) {
+    bool level_up = game_advance_score(frame_ns, &game->score_ns, &game->score);
+
+    if (level_up) {
+        game_queue_difficulty(game);
+    }
+    if (game->score != game->sent_score) {
+        game_queue(game, METEOR_CMD_SET_SCORE, game->score);
+        game->sent_score = game->score;
+    }
+    return level_up;
+}
+
+// Second half, once the IMU was read: steering from tilt_mdeg, unless the
+// module steers, and maybe a new meteor
+void game_frame_move(game_t *game, int32_t tilt_mdeg, long long frame_ns) {
+    int meteor_pos;
+
+    if (!game->kernel_input) {
+        game->character_pos = calc_travel_pos(tilt_mdeg, game->character_pos, frame_ns);
+        game_queue(game, METEOR_CMD_SET_CHAR_X, game->character_pos);
+    }
+
+    meteor_pos = rand_spawn_meteor(frame_ns);
+    if (meteor_pos >= 0) {
+        game_queue(game, METEOR_CMD_SPAWN, meteor_pos);
+    }
+}
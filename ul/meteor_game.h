@@ -0,0 +1,43 @@
+#ifndef METEOR_GAME_H
+#define METEOR_GAME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "meteor_dash.h"
+
+// Game balance is tuned per 50 ms step, the original loop period
+#define STEP_NS (METEOR_STEP_MS * 1000 * 1000LL)
+#define MAX_DIFFICULTY 10
+
+// Where the character starts every game
+#define GAME_START_POS 100
+// Most commands one step queues, a level up sends fall rate, input and level
+#define GAME_MAX_CMDS 8
+
+// Current difficulty, 1 to MAX_DIFFICULTY, raised by game_advance_score
+extern int difficulty_lvl;
+
+// One game of the userspace loop, played a frame at a time by the game_start
+// and game_frame_* steps. Each step queues the commands the frame sends to
+// the module in cmds, the caller hands them over and clears n_cmds.
+typedef struct {
+    bool kernel_input;      // the module steers, SET_INPUT follows the difficulty
+    int score;
+    int sent_score;         // score the module shows
+    long long score_ns;     // game time not yet scored
+    int character_pos;
+    struct meteor_cmd cmds[GAME_MAX_CMDS];
+    int n_cmds;
+} game_t;
+
+// Function declarations
+int calc_travel_pos(int32_t tilt_mdeg, int curr_pos, long long frame_ns);
+int rand_spawn_meteor(long long frame_ns);
+int game_fall_rate(void);
+bool game_advance_score(long long frame_ns, long long *score_ns, int *score);
+void game_start(game_t *game, bool kernel_input);
+bool game_frame_score(game_t *game, long long frame_ns);
+void game_frame_move(game_t *game, int32_t tilt_mdeg, long long frame_ns);
+
+#endif
@@ -0,0 +1,167 @@
+#include "profiler.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Per-phase frame timings. Each phase goes into a log-linear histogram, 16
+// linear buckets per power of two, so percentiles are within about 6% and
+// recording costs a clock read and an increment. A CSV row per frame is
+// optional.
+
+#define SUB_BITS 4
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define N_BUCKETS (SUB_BUCKETS * 40)
+
+static const char *phase_names[PROF_N_PHASES] = {
+    [PROF_OVERSHOOT] = "overshoot",
+    [PROF_IMU] = "imu",
+    [PROF_LOGIC] = "logic",
+    [PROF_FORMAT] = "format",
+    [PROF_WRITE] = "write",
+    [PROF_EVENTS] = "events",
+};
+
+static bool enabled = false;
+static FILE *csv_file;
+static uint32_t histograms[PROF_N_PHASES][N_BUCKETS];
+static uint64_t max_ns[PROF_N_PHASES];
+static uint64_t frame_ns[PROF_N_PHASES];
+static uint64_t n_frames;
+static struct timespec last_mark;
+
+static uint64_t elapsed_since_mark(void) {
+    struct timespec now;
+    uint64_t elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - last_mark.tv_sec) * 1000000000LL + (now.tv_nsec - last_mark.tv_nsec);
+    last_mark = now;
+    return elapsed;
+}
+
+static int bucket_of(uint64_t value) {
+    int exponent;
+    int bucket;
+
+    if (value < SUB_BUCKETS) {
+        return value;
+    }
+    exponent = 63 - __builtin_clzll(value);
+    bucket = (exponent - SUB_BITS + 1) * SUB_BUCKETS + ((value >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1));
+    return bucket < N_BUCKETS ? bucket : N_BUCKETS - 1;
+}
+
+// Smallest value that lands in bucket
+static uint64_t bucket_floor(int bucket) {
+    int exponent;
+
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    exponent = bucket / SUB_BUCKETS + SUB_BITS - 1;
+    return (uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << (exponent - SUB_BITS);
+}
+
+static uint64_t percentile(prof_phase_t phase, double fraction) {
+    uint64_t target = (uint64_t)(fraction * n_frames);
+    uint64_t seen = 0;
+    int bucket;
+
+    for (bucket = 0; bucket < N_BUCKETS; bucket++) {
+        seen += histograms[phase][bucket];
+        if (seen > target) {
+            return bucket_floor(bucket);
+        }
+    }
+    return max_ns[phase];
+}
+
+static void report_at_exit(void) {
+    prof_report(stderr);
+    if (csv_file) {
+        fclose(csv_file);
+        csv_file = NULL;
+    }
+}
+
+// Turn profiling on, csv_path may be NULL for percentiles only. The report
+// is printed to stderr when the program exits. Returns 0 or -1 if the CSV
+// file could not be created.
+int prof_init(const char *csv_path) {
+    int phase;
+
+    if (csv_path && *csv_path) {
+        csv_file = fopen(csv_path, "w");
+        if (!csv_file) {
+            return -1;
+        }
+        fprintf(csv_file, "frame");
+        for (phase = 0; phase < PROF_N_PHASES; phase++) {
+            fprintf(csv_file, ",%s_ns", phase_names[phase]);
+        }
+        fprintf(csv_file, "\n");
+    }
+
+    enabled = true;
+    atexit(report_at_exit);
+    return 0;
+}
+
+void prof_frame_begin(long long overshoot_ns) {
+    if (!enabled) {
+        return;
+    }
+    memset(frame_ns, 0, sizeof(frame_ns));
+    frame_ns[PROF_OVERSHOOT] = overshoot_ns > 0 ? overshoot_ns : 0;
+    clock_gettime(CLOCK_MONOTONIC, &last_mark);
+}
+
+// Close the phase that has been running since the previous mark
+void prof_mark(prof_phase_t phase) {
+    if (!enabled) {
+        return;
+    }
+    frame_ns[phase] += elapsed_since_mark();
+}
+
+void prof_frame_end(void) {
+    int phase;
+
+    if (!enabled) {
+        return;
+    }
+
+    for (phase = 0; phase < PROF_N_PHASES; phase++) {
+        histograms[phase][bucket_of(frame_ns[phase])]++;
+        if (frame_ns[phase] > max_ns[phase]) {
+            max_ns[phase] = frame_ns[phase];
+        }
+    }
+
+    if (csv_file) {
+        fprintf(csv_file, "%llu", (unsigned long long)n_frames);
+        for (phase = 0; phase < PROF_N_PHASES; phase++) {
+            fprintf(csv_file, ",%llu", (unsigned long long)frame_ns[phase]);
+        }
+        fprintf(csv_file, "\n");
+    }
+    n_frames++;
+}
+
+void prof_report(FILE *out) {
+    int phase;
+
+    if (!enabled || n_frames == 0) {
+        return;
+    }
+
+    fprintf(out, "%llu frames, times in us\n", (unsigned long long)n_frames);
+    fprintf(out, "%-10s %10s %10s %10s %10s\n", "phase", "p50", "p99", "p999", "max");
+    for (phase = 0; phase < PROF_N_PHASES; phase++) {
+        fprintf(out, "%-10s %10.1f %10.1f %10.1f %10.1f\n", phase_names[phase],
+                percentile(phase, 0.5) / 1000.0, percentile(phase, 0.99) / 1000.0,
+                percentile(phase, 0.999) / 1000.0, max_ns[phase] / 1000.0);
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+
+// Phases of a game loop iteration, in the order they run
+typedef enum {
+    PROF_OVERSHOOT,     // how late the loop woke up after its deadline
+    PROF_IMU,           // reading the IMU
+    PROF_LOGIC,         // position, spawn and score updates
+    PROF_FORMAT,        // building the frame's commands
+    PROF_WRITE,         // handing them to the device
+    PROF_EVENTS,        // draining game events
+    PROF_N_PHASES,
+} prof_phase_t;
+
+// Function declarations
+int prof_init(const char *csv_path);
+void prof_frame_begin(long long overshoot_ns);
+void prof_mark(prof_phase_t phase);
+void prof_frame_end(void);
+void prof_report(FILE *out);
+
+#endif